@@ -5,22 +5,25 @@
 #include <iostream>
 #include <memory>
 #include <ctime>
+#include <cstring>
 #include <thread>
 #include <chrono>
-#include <regex>
 #include <algorithm>
 
+// tape of the camera in the pool.
+static const std::string CAM_TAPE = "cam";
+
 int main(int argc, char* argv[])
 {
-    auto tp = std::make_shared<vr::tape>();
     auto wt = std::make_shared<writer>();
     auto streamer = std::make_shared<vr::streamer>();
     auto rtsp = std::make_shared<vr::rtsp_reader>();
-    if(argc < 3)
+    if(argc < 4)
     {
         std::cout<<argv[0]<<" ";
         std::cout<<"[rtsp url]"<<" ";
-        std::cout<<"[server port]";
+        std::cout<<"[server port]"<<" ";
+        std::cout<<"[tape root]";
         std::cout<<std::endl;
         return 1;
     }
@@ -40,79 +43,44 @@ int main(int argc, char* argv[])
     }
     vr::tape::option opt;
     opt.max_days = 90;
-    if(!tp->open(argv[3], opt))
+    // clients play tapes of the pool on their own, e.g. "play cam <sec> [speed]".
+    auto pool = std::make_shared<vr::tape_pool>(argv[3],
+        [opt](std::string){ return opt; });
+    auto tp = pool->find(CAM_TAPE);
+    if(!tp)
+    {
+        tp = pool->create(CAM_TAPE, opt);
+    }
+    if(!tp)
     {
         std::cout<<"tape can not open."<<std::endl;
-        tp->close();
+        pool->close();
         return 1;
     }
+    streamer->set_tape_pool(pool);
+    // local readers attach to vr-<server port>.
+    auto bus = std::make_shared<vr::frame_bus>();
+    if(!bus->create(std::string("vr-") + argv[2], vr::frame_bus::option()))
+    {
+        std::cout<<"frame bus can not open."<<std::endl;
+        bus.reset();
+    }
     wt->set_tape(tp);
     wt->set_cam_reader(rtsp);
+    wt->set_frame_bus(bus);
+    wt->set_streamer(streamer);
     if(!wt->start())
     {
         std::cout<<"writer can not start."<<std::endl;
         wt->close();
         return 1;
     }
-    auto past_criterion = "^start:(\\d{4}-\\d{2}-\\d{2}@\\d{2}-\\d{2}-\\d{2})";
-    std::regex re_past(past_criterion);
-    std::thread view_thread;
-    bool stop;
     while(true)
     {
         std::string cmd;
-        std::cmatch cm;
         std::cout<<"command: ";
         std::cin>>cmd;
-        if(std::regex_match(cmd.c_str(), cm, re_past))
-        {
-            std::tm t;
-            strptime(cm[1].str().c_str(), "%Y-%m-%d@%H-%M-%S", &t);
-            auto tt = timegm(&t);
-            std::cout<<"New past view"<<std::endl;
-            stop = true;
-            std::cout<<"wait old past view... ";
-            if(view_thread.joinable())
-            {
-                view_thread.join();
-            }
-            std::cout<<"done."<<std::endl;
-            stop = false;
-            view_thread = std::thread(
-                [&tp, &stop, &streamer, tt]() mutable
-                {
-                    using namespace std::chrono;
-                    using ms = duration<int, std::milli>;
-                    auto tp_iter = tp->find(tt);
-                    if(tp_iter == tp->end())
-                    {
-                        std::cout<<"tape not found."<<std::endl;
-                        return;
-                    }
-                    auto fi = *tp_iter;
-                    while(true)
-                    {
-                        if(stop)
-                        {
-                            break;
-                        }
-                        auto ftime = fi.msec;
-                        ++tp_iter;
-                        std::cout << "fi.data: " << fi.data.size() << ", msec: " << ftime.count() << std::endl;
-                        if(!fi.data.empty())
-                            streamer->broadcast(fi.data);
-                        if(tp_iter == tp->end())
-                            break;
-                        fi = *tp_iter;
-                        auto interval = (fi.msec - ftime).count();
-                        interval = std::min(std::max((long long)interval, 0ll), 200ll);
-                        std::this_thread::sleep_for(ms(interval));
-                        
-                    }
-                }
-            );
-        }
-        else if(cmd == "timeline")
+        if(cmd == "timeline")
         {
             auto tls = tp->timeline();
             
@@ -162,13 +130,8 @@ int main(int argc, char* argv[])
         }
         else if(cmd == "stop")
         {
-            stop = true;
-            if(view_thread.joinable())
-            {
-                view_thread.join();
-            }
             streamer->close();
-            tp->close();
+            pool->close();
             break;
         }
     }
@@ -43,6 +43,30 @@ bool writer::start()
                 if(_stop_working)
                     break;
                 gop.push_back({fr.data, ms_now});
+                if(fr.extra_data)
+                {
+                    gop.back().extradata = _cr->extradata();
+                }
+                // only key frames are prefixed by the extradata,
+                // others are published as they are.
+                const std::vector<uint8_t>* live = &gop.back().data;
+                std::shared_ptr<const std::vector<uint8_t>> shared;
+                // the streamer keeps its own copy, the bus copies into the ring.
+                if(_streamer || (fr.extra_data && _bus))
+                {
+                    shared = std::make_shared<const std::vector<uint8_t>>(
+                        fr.extra_data ? vr::storage::with_extradata(gop.back())
+                            : gop.back().data);
+                    live = shared.get();
+                }
+                if(_bus)
+                {
+                    _bus->publish(*live, ms_now.count(), 0, fr.extra_data);
+                }
+                if(_streamer)
+                {
+                    _streamer->broadcast(std::string(), shared, ms_now.count(), 0);
+                }
             }
         }
     );
@@ -59,6 +83,16 @@ void writer::set_cam_reader(std::shared_ptr<vr::cam_reader> cr)
     _cr = cr;
 }
 
+void writer::set_frame_bus(std::shared_ptr<vr::frame_bus> bus)
+{
+    _bus = bus;
+}
+
+void writer::set_streamer(std::shared_ptr<vr::streamer> streamer)
+{
+    _streamer = streamer;
+}
+
 void writer::set_delay(int sec)
 {
     _is_delay = true;
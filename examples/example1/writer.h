@@ -1,5 +1,7 @@
 #pragma once
+#include <vr/bus/frame_bus.h>
 #include <vr/recorder/tape.h>
+#include <vr/streamer/streamer.h>
 #include <vr/video/cam_reader.h>
 #include <vector>
 #include <chrono>
@@ -12,6 +14,8 @@ class writer
 {
     std::shared_ptr<vr::tape> _tp;
     std::shared_ptr<vr::cam_reader> _cr;
+    std::shared_ptr<vr::frame_bus> _bus;
+    std::shared_ptr<vr::streamer> _streamer;
     std::thread _worker;
     bool _stop_working;
     bool _is_delay;
@@ -28,6 +32,12 @@ public:
 
     void set_cam_reader(std::shared_ptr<vr::cam_reader> cr);
 
+    // publish live frames for local readers too.
+    void set_frame_bus(std::shared_ptr<vr::frame_bus> bus);
+
+    // broadcast live frames to the default channel of the streamer.
+    void set_streamer(std::shared_ptr<vr::streamer> streamer);
+
     void set_delay(int sec);
 
     void close();
@@ -0,0 +1,146 @@
+#include <vr/recorder/event_bitmap.h>
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <vector>
+
+/*
+* Checks event_bitmap against std::set around ARRAY_MAX,
+* where containers turn from arrays into bitsets and back.
+*/
+
+static int failures = 0;
+
+static void expect(const vr::event_bitmap& bm, const std::set<uint32_t>& ref,
+    const char* what)
+{
+    auto got = bm.to_vector();
+    if(bm.cardinality() != ref.size() ||
+        !std::equal(got.begin(), got.end(), ref.begin(), ref.end()))
+    {
+        std::cerr<<"[VR] event_bitmap: "<<what<<" differs, "<<bm.cardinality();
+        std::cerr<<" ordinals, expected "<<ref.size()<<std::endl;
+        ++failures;
+        return;
+    }
+    for(auto ordinal : ref)
+    {
+        if(!bm.contains(ordinal))
+        {
+            std::cerr<<"[VR] event_bitmap: "<<what<<" misses "<<ordinal<<std::endl;
+            ++failures;
+            return;
+        }
+    }
+}
+
+// every other ordinal of a container from the offset.
+static void fill(vr::event_bitmap& bm, std::set<uint32_t>& ref,
+    uint32_t base, uint32_t count, uint32_t offset)
+{
+    for(uint32_t n = 0; n < count; ++n)
+    {
+        bm.add(base + offset + n * 2);
+        ref.insert(base + offset + n * 2);
+    }
+}
+
+static std::set<uint32_t> set_and(const std::set<uint32_t>& a, const std::set<uint32_t>& b)
+{
+    std::set<uint32_t> r;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(r, r.end()));
+    return r;
+}
+
+static std::set<uint32_t> set_or(const std::set<uint32_t>& a, const std::set<uint32_t>& b)
+{
+    std::set<uint32_t> r;
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(r, r.end()));
+    return r;
+}
+
+static std::set<uint32_t> set_not(const std::set<uint32_t>& a, const std::set<uint32_t>& b)
+{
+    std::set<uint32_t> r;
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::inserter(r, r.end()));
+    return r;
+}
+
+int main()
+{
+    constexpr uint32_t max = vr::event_bitmap::ARRAY_MAX;
+    constexpr uint32_t base = 3 << 16;
+
+    // an array at the limit, and a bitset one past it.
+    vr::event_bitmap at_max, past_max;
+    std::set<uint32_t> at_ref, past_ref;
+    fill(at_max, at_ref, base, max, 0);
+    fill(past_max, past_ref, base, max + 1, 0);
+    expect(at_max, at_ref, "array of ARRAY_MAX");
+    expect(past_max, past_ref, "bitset of ARRAY_MAX + 1");
+
+    // adding out of order and twice keeps the array sorted and unique.
+    vr::event_bitmap unordered;
+    std::set<uint32_t> unordered_ref;
+    for(uint32_t n = max + 1; n > 0; --n)
+    {
+        unordered.add(base + n * 3);
+        unordered.add(base + n * 3);
+        unordered_ref.insert(base + n * 3);
+    }
+    expect(unordered, unordered_ref, "bitset added in reverse");
+
+    // ranges on both sides of the limit, and across containers.
+    for(uint32_t count : {max - 1, max, max + 1})
+    {
+        std::set<uint32_t> ref;
+        for(uint32_t n = 0; n < count; ++n)
+        {
+            ref.insert(base + n);
+        }
+        expect(vr::event_bitmap::range(base, base + count), ref, "range");
+    }
+    {
+        uint32_t from = base - max / 2;
+        uint32_t to = base + max / 2 + 1;
+        std::set<uint32_t> ref;
+        for(uint32_t n = from; n < to; ++n)
+        {
+            ref.insert(n);
+        }
+        expect(vr::event_bitmap::range(from, to), ref, "range across containers");
+    }
+
+    // odd ordinals, disjoint with the even ones above.
+    vr::event_bitmap odd;
+    std::set<uint32_t> odd_ref;
+    fill(odd, odd_ref, base, max, 1);
+
+    // two arrays unite into a bitset of 2 * ARRAY_MAX.
+    expect(at_max | odd, set_or(at_ref, odd_ref), "array | array");
+    // the bitset drops back to an array once it gets sparse.
+    auto both = at_max | odd;
+    expect(both & at_max, at_ref, "bitset & array");
+    expect(both & past_max, set_and(set_or(at_ref, odd_ref), past_ref), "bitset & bitset");
+    expect(both.and_not(odd), at_ref, "bitset and_not array");
+    expect(past_max.and_not(both), set_not(past_ref, set_or(at_ref, odd_ref)),
+        "bitset and_not bitset down to one");
+    expect(at_max.and_not(past_max), std::set<uint32_t>(), "array and_not bitset");
+    expect(past_max.and_not(at_max), set_not(past_ref, at_ref), "bitset and_not array");
+
+    // a bitset shrunk to ARRAY_MAX still grows back past it.
+    auto shrunk = both.and_not(odd);
+    auto shrunk_ref = at_ref;
+    shrunk.add(base + max * 2 + 100);
+    shrunk_ref.insert(base + max * 2 + 100);
+    expect(shrunk, shrunk_ref, "shrunk array grown past ARRAY_MAX");
+
+    if(failures > 0)
+    {
+        std::cerr<<"[VR] event_bitmap: "<<failures<<" checks failed"<<std::endl;
+        return 1;
+    }
+    std::cout<<"[VR] event_bitmap: ok"<<std::endl;
+    return 0;
+}
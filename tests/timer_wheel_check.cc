@@ -0,0 +1,113 @@
+#include <vr/utility/timer_wheel.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+/*
+* Checks timer_wheel expires timers exactly at their tick
+* around the boundaries where they cascade down a level,
+* and beyond the top level where they wait in overflow.
+*/
+
+typedef utility::timer_wheel<uint64_t> wheel;
+
+static int failures = 0;
+
+// tick 0 of the wheel, a timer due already expires there.
+static wheel::clock::time_point start_of(wheel& w)
+{
+    w.add(wheel::clock::time_point(), 0);
+    auto start = w.next_due();
+    std::vector<uint64_t> expired;
+    w.advance(start, expired);
+    return start;
+}
+
+/*
+* Add a timer due at each tick of ticks, with the tick as its value,
+* after advancing to from, and check each expires at its tick, not before.
+*/
+static void check(const char* what, uint64_t from, std::vector<uint64_t> ticks)
+{
+    wheel w;
+    auto start = start_of(w);
+    auto at = [&](uint64_t t){ return start + std::chrono::milliseconds(t); };
+    std::vector<uint64_t> expired;
+    w.advance(at(from), expired);
+    for(auto t : ticks)
+    {
+        w.add(at(t), t);
+    }
+    std::sort(ticks.begin(), ticks.end());
+    for(auto it = ticks.begin(); it != ticks.end();)
+    {
+        auto t = *it;
+        auto same = std::upper_bound(it, ticks.end(), t);
+        if(w.next_due() > at(t))
+        {
+            std::cerr<<"[VR] timer_wheel: "<<what<<" next due after "<<t<<std::endl;
+            ++failures;
+        }
+        expired.clear();
+        w.advance(at(t - 1), expired);
+        if(!expired.empty())
+        {
+            std::cerr<<"[VR] timer_wheel: "<<what<<" expired "<<expired.front();
+            std::cerr<<" before "<<t<<std::endl;
+            ++failures;
+            return;
+        }
+        // timers of the same tick expire together.
+        w.advance(at(t), expired);
+        if(expired != std::vector<uint64_t>(it, same))
+        {
+            std::cerr<<"[VR] timer_wheel: "<<what<<" missed "<<t<<std::endl;
+            ++failures;
+            return;
+        }
+        it = same;
+    }
+    if(w.size() != 0)
+    {
+        std::cerr<<"[VR] timer_wheel: "<<what<<" left "<<w.size()<<" timers"<<std::endl;
+        ++failures;
+    }
+}
+
+int main()
+{
+    constexpr uint64_t turn = wheel::SLOTS;
+    // ticks a level spans, the top one wraps into overflow.
+    std::vector<uint64_t> spans;
+    for(int level = 1; level <= wheel::LEVELS; ++level)
+    {
+        spans.push_back(uint64_t(1) << (wheel::SLOT_BITS * level));
+    }
+
+    // from tick 0, timers on both sides of every level boundary.
+    std::vector<uint64_t> ticks;
+    for(auto span : spans)
+    {
+        ticks.insert(ticks.end(), {span - 1, span, span + 1});
+    }
+    check("boundaries", 0, ticks);
+
+    // overflow, one and two turns of the top level later.
+    auto top = spans.back();
+    check("overflow", 0, {top - 1, top, top + 1, top * 2 - 1, top * 2, top * 2 + 5});
+
+    // added mid turn, the boundary is not a multiple of the distance.
+    check("mid turn", turn - 3, {turn - 2, turn, turn + 1, turn * turn, turn * turn + turn});
+    check("mid top turn", top - 2, {top - 1, top, top + turn, top * 2});
+
+    // many timers on one tick.
+    check("same tick", 5, {turn, turn, turn, 6});
+
+    if(failures > 0)
+    {
+        std::cerr<<"[VR] timer_wheel: "<<failures<<" checks failed"<<std::endl;
+        return 1;
+    }
+    std::cout<<"[VR] timer_wheel: ok"<<std::endl;
+    return 0;
+}
@@ -0,0 +1,371 @@
+#include "vr/bus/frame_bus.h"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+extern "C"
+{
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+};
+
+namespace vr
+{
+
+// an index entry of a frame in the ring.
+struct bus_slot
+{
+    // number of the frame + 1, 0 while it is written.
+    std::atomic<uint64_t> seq;
+    // data bytes written before the frame.
+    uint64_t pos;
+    uint64_t size;
+    int64_t msec;
+    uint8_t events;
+    uint8_t key;
+};
+
+/*
+* Followed by the slots and then the data in the shared memory.
+* Slots and data are written like a seqlock,
+* readers copy them and check afterwards they did not change.
+*/
+struct alignas(64) bus_ring
+{
+    // set last by the producer, readers check it first.
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t slots;
+    // number of the frame published next.
+    std::atomic<uint64_t> head;
+    // data bytes written or being written,
+    // data before reclaim - capacity may be overwritten.
+    std::atomic<uint64_t> reclaim;
+    // number of the latest key frame + 1, 0 if none.
+    std::atomic<uint64_t> key;
+    // futex readers wait on, bumped by every publish.
+    std::atomic<uint32_t> notify;
+    // readers waiting on notify, the producer wakes them only if any.
+    std::atomic<uint32_t> waiters;
+    std::atomic<uint32_t> closed;
+};
+
+static constexpr uint32_t BUS_MAGIC = 0x53554276; // "vBUS"
+static constexpr uint32_t BUS_VERSION = 1;
+
+static bus_slot* slots_of(bus_ring* ring)
+{
+    return reinterpret_cast<bus_slot*>(ring + 1);
+}
+
+static uint8_t* data_of(bus_ring* ring)
+{
+    return reinterpret_cast<uint8_t*>(slots_of(ring) + ring->slots);
+}
+
+static size_t size_of(uint64_t capacity, uint64_t slots)
+{
+    return sizeof(bus_ring) + sizeof(bus_slot) * slots + capacity;
+}
+
+// the futex is shared between processes, so it is not FUTEX_PRIVATE.
+static void futex_wait(std::atomic<uint32_t>& word, uint32_t value,
+    std::chrono::nanoseconds timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000000000;
+    ts.tv_nsec = timeout.count() % 1000000000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT,
+        value, &ts, nullptr, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE,
+        INT_MAX, nullptr, nullptr, 0);
+}
+
+frame_bus::~frame_bus()
+{
+    close();
+}
+
+bool frame_bus::create(const std::string& name, option opt)
+{
+    close();
+    if(opt.capacity < 2 || opt.slots == 0)
+    {
+        std::cerr<<"[VR] Invalid frame bus option: "<<name<<std::endl;
+        return false;
+    }
+    auto path = "/" + name;
+    // readers of a stale bus keep their mapping, the new bus is a new object.
+    shm_unlink(path.c_str());
+    int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+    if(fd < 0)
+    {
+        std::cerr<<"[VR] Fail to create frame bus: "<<name<<std::endl;
+        return false;
+    }
+    size_t size = size_of(opt.capacity, opt.slots);
+    void* mem = MAP_FAILED;
+    if(ftruncate(fd, size) == 0)
+    {
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if(mem == MAP_FAILED)
+    {
+        std::cerr<<"[VR] Fail to map frame bus: "<<name<<std::endl;
+        shm_unlink(path.c_str());
+        return false;
+    }
+    // the object is zero filled, slots need no init.
+    auto ring = new(mem) bus_ring();
+    ring->version = BUS_VERSION;
+    ring->capacity = opt.capacity;
+    ring->slots = opt.slots;
+    ring->magic.store(BUS_MAGIC, std::memory_order_release);
+    __name = name;
+    __ring = ring;
+    __size = size;
+    __pos = 0;
+    return true;
+}
+
+void frame_bus::close()
+{
+    if(!__ring)
+    {
+        return;
+    }
+    __ring->closed.store(1);
+    __ring->notify.fetch_add(1);
+    futex_wake(__ring->notify);
+    munmap(__ring, __size);
+    shm_unlink(("/" + __name).c_str());
+    __ring = nullptr;
+}
+
+bool frame_bus::publish(const uint8_t* data, size_t size,
+    int64_t msec, uint8_t events, bool key)
+{
+    if(!__ring)
+    {
+        return false;
+    }
+    uint64_t capacity = __ring->capacity;
+    if(size > capacity / 2)
+    {
+        std::cerr<<"[VR] Frame too large for frame bus: "<<__name<<std::endl;
+        return false;
+    }
+    // a frame is contiguous, it does not wrap around the end.
+    uint64_t pos = __pos;
+    if(pos % capacity + size > capacity)
+    {
+        pos += capacity - pos % capacity;
+    }
+    __pos = pos + size;
+    __ring->reclaim.store(__pos, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(data_of(__ring) + pos % capacity, data, size);
+
+    uint64_t seq = __ring->head.load(std::memory_order_relaxed);
+    auto& slot = slots_of(__ring)[seq % __ring->slots];
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.pos = pos;
+    slot.size = size;
+    slot.msec = msec;
+    slot.events = events;
+    slot.key = key;
+    slot.seq.store(seq + 1, std::memory_order_release);
+    if(key)
+    {
+        __ring->key.store(seq + 1, std::memory_order_release);
+    }
+    __ring->head.store(seq + 1, std::memory_order_release);
+
+    __ring->notify.fetch_add(1);
+    if(__ring->waiters.load() > 0)
+    {
+        futex_wake(__ring->notify);
+    }
+    return true;
+}
+
+bool frame_bus::publish(const std::vector<uint8_t>& data,
+    int64_t msec, uint8_t events, bool key)
+{
+    return publish(data.data(), data.size(), msec, events, key);
+}
+
+uint64_t frame_bus::published() const
+{
+    return __ring ? __ring->head.load(std::memory_order_relaxed) : 0;
+}
+
+frame_bus_reader::~frame_bus_reader()
+{
+    close();
+}
+
+bool frame_bus_reader::attach(const std::string& name)
+{
+    close();
+    auto path = "/" + name;
+    int fd = shm_open(path.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        std::cerr<<"[VR] Fail to open frame bus: "<<name<<std::endl;
+        return false;
+    }
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(bus_ring))
+    {
+        mem = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if(mem == MAP_FAILED)
+    {
+        std::cerr<<"[VR] Fail to map frame bus: "<<name<<std::endl;
+        return false;
+    }
+    auto ring = static_cast<bus_ring*>(mem);
+    if(ring->magic.load(std::memory_order_acquire) != BUS_MAGIC ||
+        ring->version != BUS_VERSION ||
+        size_of(ring->capacity, ring->slots) > size_t(st.st_size))
+    {
+        std::cerr<<"[VR] Not a frame bus: "<<name<<std::endl;
+        munmap(mem, st.st_size);
+        return false;
+    }
+    __ring = ring;
+    __size = st.st_size;
+    // the latest gop can be decoded from its key frame.
+    uint64_t key = __ring->key.load(std::memory_order_acquire);
+    __next = key > 0 ? key - 1 : __ring->head.load(std::memory_order_acquire);
+    __overrun = false;
+    __lost = 0;
+    return true;
+}
+
+void frame_bus_reader::close()
+{
+    if(!__ring)
+    {
+        return;
+    }
+    munmap(__ring, __size);
+    __ring = nullptr;
+}
+
+bool frame_bus_reader::read(frame& fr, std::chrono::milliseconds timeout)
+{
+    if(!__ring)
+    {
+        return false;
+    }
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while(true)
+    {
+        auto res = try_read(fr);
+        if(res == result::ok)
+        {
+            fr.overrun = __overrun;
+            __overrun = false;
+            return true;
+        }
+        if(res == result::overrun)
+        {
+            // skip to the latest key frame, or to the next one to come.
+            uint64_t key = __ring->key.load(std::memory_order_acquire);
+            uint64_t head = __ring->head.load(std::memory_order_acquire);
+            uint64_t next = key > __next + 1 ? key - 1 : head;
+            __lost += next - __next;
+            __next = next;
+            __overrun = true;
+            continue;
+        }
+        if(closed() || std::chrono::steady_clock::now() >= deadline)
+        {
+            return false;
+        }
+        wait(deadline);
+    }
+}
+
+frame_bus_reader::result frame_bus_reader::try_read(frame& fr)
+{
+    uint64_t head = __ring->head.load(std::memory_order_acquire);
+    if(__next >= head)
+    {
+        return result::not_yet;
+    }
+    uint64_t capacity = __ring->capacity;
+    auto& slot = slots_of(__ring)[__next % __ring->slots];
+    if(slot.seq.load(std::memory_order_acquire) != __next + 1)
+    {
+        return result::overrun;
+    }
+    uint64_t pos = slot.pos;
+    uint64_t size = slot.size;
+    fr.msec = slot.msec;
+    fr.events = slot.events;
+    fr.key = slot.key != 0;
+    // fields may be torn by the producer, keep the copy in bounds.
+    if(size > capacity / 2 || pos % capacity + size > capacity)
+    {
+        return result::overrun;
+    }
+    fr.data.resize(size);
+    std::memcpy(fr.data.data(), data_of(__ring) + pos % capacity, size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(slot.seq.load(std::memory_order_relaxed) != __next + 1 ||
+        __ring->reclaim.load(std::memory_order_relaxed) > pos + capacity)
+    {
+        return result::overrun;
+    }
+    fr.seq = __next++;
+    return result::ok;
+}
+
+void frame_bus_reader::wait(std::chrono::steady_clock::time_point deadline)
+{
+    __ring->waiters.fetch_add(1);
+    uint32_t value = __ring->notify.load();
+    // a publish after loading the value changes it, the wait returns at once.
+    if(__ring->head.load() <= __next && !closed())
+    {
+        auto left = deadline - std::chrono::steady_clock::now();
+        if(left > std::chrono::steady_clock::duration::zero())
+        {
+            futex_wait(__ring->notify, value,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(left));
+        }
+    }
+    __ring->waiters.fetch_sub(1);
+}
+
+bool frame_bus_reader::closed() const
+{
+    return !__ring || __ring->closed.load() != 0;
+}
+
+uint64_t frame_bus_reader::lost() const
+{
+    return __lost;
+}
+
+} // end namespace vr
@@ -0,0 +1,136 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vr
+{
+
+// layout of a bus in shared memory, see frame_bus.cc.
+struct bus_ring;
+
+/*
+* Live frames of a camera in shared memory,
+* for local processes(e.g. analytics workers) to read without sockets.
+* The producer publishes frames into a ring and any number of readers
+* follow it on their own, it never waits for them.
+* A reader lapped by the producer gets an overrun
+* and resumes from the latest key frame.
+*
+* A bus is a POSIX shared memory object named "/" + name,
+* so readers attach by the name, e.g. of the camera.
+*/
+class frame_bus
+{
+public:
+    struct option
+    {
+        // payload bytes of the ring, a frame takes at most half of it.
+        size_t capacity = 64ull << 20;
+        // frames indexed by the ring, older ones are overwritten.
+        size_t slots = 1024;
+    };
+
+    frame_bus() = default;
+
+    frame_bus(const frame_bus&) = delete;
+
+    frame_bus& operator=(const frame_bus&) = delete;
+
+    ~frame_bus();
+
+    // create the bus, replacing a stale one of the name(e.g. after a crash).
+    bool create(const std::string& name, option opt);
+
+    // readers see the bus closed, its name is removed.
+    void close();
+
+    // publish a frame, false if it is larger than the ring allows.
+    // key is the first frame of a gop, readers start or resume from it.
+    bool publish(const uint8_t* data, size_t size,
+        int64_t msec, uint8_t events, bool key);
+
+    bool publish(const std::vector<uint8_t>& data,
+        int64_t msec, uint8_t events, bool key);
+
+    // frames published so far.
+    uint64_t published() const;
+
+private:
+    std::string __name;
+    bus_ring* __ring = nullptr;
+    size_t __size = 0;
+    // data bytes written so far, the ring offset is modulo the capacity.
+    uint64_t __pos = 0;
+};
+
+/*
+* Reader of a frame bus, in any process.
+* Frames are copied out of the ring, then checked not to be overwritten
+* in the meantime, so a reader never holds the producer.
+*/
+class frame_bus_reader
+{
+public:
+    struct frame
+    {
+        std::vector<uint8_t> data;
+        int64_t msec = 0;
+        uint8_t events = 0;
+        bool key = false;
+        // number of the frame, counted by the producer from 0.
+        uint64_t seq = 0;
+        // frames were lost right before this one.
+        bool overrun = false;
+    };
+
+    frame_bus_reader() = default;
+
+    frame_bus_reader(const frame_bus_reader&) = delete;
+
+    frame_bus_reader& operator=(const frame_bus_reader&) = delete;
+
+    ~frame_bus_reader();
+
+    // attach to the bus of the name, starting from its latest key frame.
+    bool attach(const std::string& name);
+
+    void close();
+
+    /*
+    * Read the next frame into fr, reusing its buffer.
+    * Waits up to timeout for it, returns false on timeout
+    * or if the producer closed the bus, see closed().
+    */
+    bool read(frame& fr, std::chrono::milliseconds timeout);
+
+    // the producer closed the bus, attach again for a new one.
+    bool closed() const;
+
+    // frames lost by overruns so far.
+    uint64_t lost() const;
+
+private:
+    enum class result
+    {
+        ok,
+        not_yet,
+        overrun
+    };
+
+    result try_read(frame& fr);
+
+    // wait for a frame after __next until the deadline.
+    void wait(std::chrono::steady_clock::time_point deadline);
+
+private:
+    bus_ring* __ring = nullptr;
+    size_t __size = 0;
+    // number of the frame to read next.
+    uint64_t __next = 0;
+    bool __overrun = false;
+    uint64_t __lost = 0;
+};
+
+} // end namespace vr
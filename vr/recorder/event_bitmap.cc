@@ -0,0 +1,357 @@
+#include "vr/recorder/event_bitmap.h"
+#include <algorithm>
+#include <iterator>
+
+namespace vr
+{
+
+namespace
+{
+
+constexpr size_t BITSET_WORDS = 65536 / 64;
+
+inline uint32_t popcount(uint64_t w)
+{
+    return static_cast<uint32_t>(__builtin_popcountll(w));
+}
+
+} // end namespace
+
+bool event_bitmap::container::contains(uint16_t low) const
+{
+    if(is_bitset())
+    {
+        return (bits[low >> 6] >> (low & 63)) & 1;
+    }
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+void event_bitmap::container::add(uint16_t low)
+{
+    if(is_bitset())
+    {
+        uint64_t& w = bits[low >> 6];
+        uint64_t m = uint64_t(1) << (low & 63);
+        card += (w & m) ? 0 : 1;
+        w |= m;
+        return;
+    }
+    if(array.empty() || array.back() < low)
+    {
+        array.push_back(low);
+    }
+    else
+    {
+        auto it = std::lower_bound(array.begin(), array.end(), low);
+        if(*it == low)
+        {
+            return;
+        }
+        array.insert(it, low);
+    }
+    ++card;
+    if(card > ARRAY_MAX)
+    {
+        to_bitset();
+    }
+}
+
+void event_bitmap::container::to_bitset()
+{
+    if(is_bitset())
+    {
+        return;
+    }
+    bits.assign(BITSET_WORDS, 0);
+    for(auto low : array)
+    {
+        bits[low >> 6] |= uint64_t(1) << (low & 63);
+    }
+    array.clear();
+    array.shrink_to_fit();
+}
+
+void event_bitmap::container::shrink()
+{
+    if(!is_bitset() || card > ARRAY_MAX)
+    {
+        return;
+    }
+    array.clear();
+    array.reserve(card);
+    for(size_t n = 0; n < BITSET_WORDS; ++n)
+    {
+        uint64_t w = bits[n];
+        while(w)
+        {
+            array.push_back(static_cast<uint16_t>(n * 64 + __builtin_ctzll(w)));
+            w &= w - 1;
+        }
+    }
+    bits.clear();
+    bits.shrink_to_fit();
+}
+
+void event_bitmap::add(uint32_t ordinal)
+{
+    uint16_t high = ordinal >> 16;
+    auto it = __cons.empty() ? __cons.end() : std::prev(__cons.end());
+    if(it == __cons.end() || it->first != high)
+    {
+        it = __cons.try_emplace(high).first;
+    }
+    it->second.add(static_cast<uint16_t>(ordinal & 0xFFFF));
+}
+
+bool event_bitmap::contains(uint32_t ordinal) const
+{
+    auto it = __cons.find(ordinal >> 16);
+    if(it == __cons.end())
+    {
+        return false;
+    }
+    return it->second.contains(static_cast<uint16_t>(ordinal & 0xFFFF));
+}
+
+size_t event_bitmap::cardinality() const
+{
+    size_t total = 0;
+    for(auto& it : __cons)
+    {
+        total += it.second.card;
+    }
+    return total;
+}
+
+bool event_bitmap::empty() const
+{
+    return cardinality() == 0;
+}
+
+void event_bitmap::clear()
+{
+    __cons.clear();
+}
+
+std::vector<uint32_t> event_bitmap::to_vector() const
+{
+    std::vector<uint32_t> ordinals;
+    ordinals.reserve(cardinality());
+    for(auto& it : __cons)
+    {
+        uint32_t high = uint32_t(it.first) << 16;
+        auto& con = it.second;
+        if(con.is_bitset())
+        {
+            for(size_t n = 0; n < BITSET_WORDS; ++n)
+            {
+                uint64_t w = con.bits[n];
+                while(w)
+                {
+                    ordinals.push_back(high | uint32_t(n * 64 + __builtin_ctzll(w)));
+                    w &= w - 1;
+                }
+            }
+        }
+        else
+        {
+            for(auto low : con.array)
+            {
+                ordinals.push_back(high | low);
+            }
+        }
+    }
+    return ordinals;
+}
+
+event_bitmap event_bitmap::range(uint32_t from, uint32_t to)
+{
+    event_bitmap bm;
+    while(from < to)
+    {
+        uint16_t high = from >> 16;
+        uint32_t con_end = std::min<uint64_t>(to, (uint64_t(high) + 1) << 16);
+        auto& con = bm.__cons[high];
+        con.card = con_end - from;
+        if(con.card > ARRAY_MAX)
+        {
+            con.bits.assign(BITSET_WORDS, 0);
+            for(uint32_t n = from; n < con_end; ++n)
+            {
+                uint16_t low = n & 0xFFFF;
+                con.bits[low >> 6] |= uint64_t(1) << (low & 63);
+            }
+        }
+        else
+        {
+            con.array.reserve(con.card);
+            for(uint32_t n = from; n < con_end; ++n)
+            {
+                con.array.push_back(static_cast<uint16_t>(n & 0xFFFF));
+            }
+        }
+        from = con_end;
+    }
+    return bm;
+}
+
+event_bitmap event_bitmap::operator&(const event_bitmap& other) const
+{
+    event_bitmap bm;
+    auto a = __cons.begin();
+    auto b = other.__cons.begin();
+    while(a != __cons.end() && b != other.__cons.end())
+    {
+        if(a->first < b->first) ++a;
+        else if(b->first < a->first) ++b;
+        else
+        {
+            auto con = intersect(a->second, b->second);
+            if(con.card)
+            {
+                bm.__cons.emplace_hint(bm.__cons.end(), a->first, std::move(con));
+            }
+            ++a;
+            ++b;
+        }
+    }
+    return bm;
+}
+
+event_bitmap event_bitmap::operator|(const event_bitmap& other) const
+{
+    event_bitmap bm = *this;
+    for(auto& it : other.__cons)
+    {
+        auto found = bm.__cons.find(it.first);
+        if(found == bm.__cons.end())
+        {
+            bm.__cons.emplace(it.first, it.second);
+        }
+        else
+        {
+            found->second = unite(found->second, it.second);
+        }
+    }
+    return bm;
+}
+
+event_bitmap event_bitmap::and_not(const event_bitmap& other) const
+{
+    event_bitmap bm;
+    for(auto& it : __cons)
+    {
+        auto found = other.__cons.find(it.first);
+        if(found == other.__cons.end())
+        {
+            bm.__cons.emplace_hint(bm.__cons.end(), it.first, it.second);
+            continue;
+        }
+        auto con = subtract(it.second, found->second);
+        if(con.card)
+        {
+            bm.__cons.emplace_hint(bm.__cons.end(), it.first, std::move(con));
+        }
+    }
+    return bm;
+}
+
+event_bitmap::container event_bitmap::intersect(
+    const container& a, const container& b)
+{
+    container con;
+    if(a.is_bitset() && b.is_bitset())
+    {
+        con.bits.resize(BITSET_WORDS);
+        uint32_t card = 0;
+        for(size_t n = 0; n < BITSET_WORDS; ++n)
+        {
+            con.bits[n] = a.bits[n] & b.bits[n];
+            card += popcount(con.bits[n]);
+        }
+        con.card = card;
+        con.shrink();
+    }
+    else if(a.is_bitset() || b.is_bitset())
+    {
+        auto& arr = a.is_bitset() ? b.array : a.array;
+        auto& bs = a.is_bitset() ? a : b;
+        for(auto low : arr)
+        {
+            if(bs.contains(low))
+            {
+                con.array.push_back(low);
+            }
+        }
+        con.card = con.array.size();
+    }
+    else
+    {
+        std::set_intersection(a.array.begin(), a.array.end(),
+            b.array.begin(), b.array.end(), std::back_inserter(con.array));
+        con.card = con.array.size();
+    }
+    return con;
+}
+
+event_bitmap::container event_bitmap::unite(
+    const container& a, const container& b)
+{
+    container con;
+    if(!a.is_bitset() && !b.is_bitset())
+    {
+        std::set_union(a.array.begin(), a.array.end(),
+            b.array.begin(), b.array.end(), std::back_inserter(con.array));
+        con.card = con.array.size();
+        if(con.card > ARRAY_MAX)
+        {
+            con.to_bitset();
+        }
+        return con;
+    }
+    container x = a;
+    container y = b;
+    x.to_bitset();
+    y.to_bitset();
+    con.bits.resize(BITSET_WORDS);
+    uint32_t card = 0;
+    for(size_t n = 0; n < BITSET_WORDS; ++n)
+    {
+        con.bits[n] = x.bits[n] | y.bits[n];
+        card += popcount(con.bits[n]);
+    }
+    con.card = card;
+    return con;
+}
+
+event_bitmap::container event_bitmap::subtract(
+    const container& a, const container& b)
+{
+    container con;
+    if(a.is_bitset())
+    {
+        container y = b;
+        y.to_bitset();
+        con.bits.resize(BITSET_WORDS);
+        uint32_t card = 0;
+        for(size_t n = 0; n < BITSET_WORDS; ++n)
+        {
+            con.bits[n] = a.bits[n] & ~y.bits[n];
+            card += popcount(con.bits[n]);
+        }
+        con.card = card;
+        con.shrink();
+        return con;
+    }
+    for(auto low : a.array)
+    {
+        if(!b.contains(low))
+        {
+            con.array.push_back(low);
+        }
+    }
+    con.card = con.array.size();
+    return con;
+}
+
+} // end namespace vr
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace vr
+{
+
+/*
+* Compressed bitmap of gop ordinals, similar to roaring bitmap.
+* Ordinals are split by upper 16 bits into containers.
+* A container is a sorted array of lower 16 bits while it is sparse,
+* and turns into a bitset of 1024 words once it gets dense.
+* Operations on bitsets are plain word loops, so compilers vectorize them.
+*/
+class event_bitmap
+{
+    struct container
+    {
+        // sorted lower 16 bits, used while bits is empty.
+        std::vector<uint16_t> array;
+        // bitset of 65536 bits, used if it is not empty.
+        std::vector<uint64_t> bits;
+        // number of set bits.
+        uint32_t card = 0;
+
+        bool is_bitset() const { return !bits.empty(); }
+
+        bool contains(uint16_t low) const;
+
+        void add(uint16_t low);
+
+        void to_bitset();
+
+        // turn into array if it gets sparse.
+        void shrink();
+    };
+
+    std::map<uint16_t, container> __cons;
+
+public:
+    // containers with more values than this are bitsets.
+    static constexpr uint32_t ARRAY_MAX = 4096;
+
+    // add an ordinal, appending in ascending order is the fast path.
+    void add(uint32_t ordinal);
+
+    bool contains(uint32_t ordinal) const;
+
+    size_t cardinality() const;
+
+    bool empty() const;
+
+    void clear();
+
+    std::vector<uint32_t> to_vector() const;
+
+    // bitmap with all ordinals in [from, to).
+    static event_bitmap range(uint32_t from, uint32_t to);
+
+    event_bitmap operator&(const event_bitmap& other) const;
+
+    event_bitmap operator|(const event_bitmap& other) const;
+
+    // ordinals in this but not in other.
+    event_bitmap and_not(const event_bitmap& other) const;
+
+private:
+    static container intersect(const container& a, const container& b);
+
+    static container unite(const container& a, const container& b);
+
+    static container subtract(const container& a, const container& b);
+};
+
+} // end namespace vr
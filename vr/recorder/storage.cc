@@ -1,7 +1,15 @@
 #include "vr/recorder/storage.h"
 #include "vr/utility/handy.h"
+#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <algorithm>
+
+extern "C"
+{
+#include <sys/stat.h>
+#include <unistd.h>
+}
 
 namespace vr
 {
@@ -24,10 +32,26 @@ storage::storage(std::string file_name)
     {
         __timeline.push_back(std::map<uint64_t, uint64_t>());
     }
+    __evt_idx.resize(__max_events);
     
     if(!std::filesystem::exists(fname + ".index")){
         return;
     }
+    {
+        std::error_code ec;
+        auto size_of = [&ec](std::string file) -> int64_t {
+            auto size = std::filesystem::file_size(file, ec);
+            return ec.value() ? 0 : static_cast<int64_t>(size);
+        };
+        __dsize = size_of(fname + ".data");
+        __isize = size_of(fname + ".index");
+        __tsize = size_of(fname + ".timeline");
+        __esize = size_of(fname + ".extra");
+    }
+    read_extra_file(fname);
+    identify();
+    // skip recomputing timelines if the segment was sealed.
+    __tl_cached = read_timeline_file(fname);
     /*
     if(!repair_if_corrupt(fname))
     {
@@ -51,6 +75,9 @@ void storage::close()
 {
     idxes.clear();
     __timeline.clear();
+    __gops.clear();
+    __evt_idx.clear();
+    __extras.clear();
 }
 
 bool storage::remove()
@@ -71,23 +98,374 @@ bool storage::remove()
             status = false;
         }
     }
+    {
+        // timeline file is optional.
+        std::error_code ec;
+        std::filesystem::remove(fname + ".timeline", ec);
+        std::filesystem::remove(fname + ".extra", ec);
+    }
+    __dsize = 0;
+    __isize = 0;
+    __tsize = 0;
+    __esize = 0;
     return status;
 }
 
+bool storage::seal()
+{
+    std::unique_lock<std::mutex> lock(imtx);
+    if(__timeline.empty())
+    {
+        return false;
+    }
+    std::error_code ec;
+    auto index_size = static_cast<int64_t>(
+        std::filesystem::file_size(fname + ".index", ec));
+    if(ec.value())
+    {
+        return false;
+    }
+    if(__preallocated)
+    {
+        // give back blocks reserved but not written.
+        std::unique_lock<std::mutex> dlock(dmtx);
+        std::filesystem::resize_file(fname + ".data", __dsize, ec);
+        __preallocated = false;
+    }
+    auto size = write_timeline_file(fname, __timeline, __flags, index_size);
+    if(size < 0)
+    {
+        return false;
+    }
+    __tsize = size;
+    __tl_cached = true;
+    return true;
+}
+
+bool storage::prepare(int64_t preallocate)
+{
+    std::error_code ec;
+    if(!utility::create_directories(
+        std::filesystem::path(fname).parent_path().string(), ec))
+    {
+        return false;
+    }
+    {
+        std::unique_lock<std::mutex> lock(dmtx);
+        std::ofstream dfile(fname + ".data", std::ios::binary | std::ios::app);
+        dfile.seekp(0, std::ios::end);
+        if(dfile.tellp() == 0)
+        {
+            dfile.write(__magic_code, sizeof(__magic_code));
+            dfile.write(&__version, sizeof(__version));
+        }
+        if(!dfile.good())
+        {
+            return false;
+        }
+        __dsize = static_cast<int64_t>(dfile.tellp());
+    }
+    identify();
+    {
+        std::unique_lock<std::mutex> lock(imtx);
+        std::ofstream ifile(fname + ".index", std::ios::binary | std::ios::app);
+        ifile.seekp(0, std::ios::end);
+        if(ifile.tellp() == 0)
+        {
+            ifile.write(__magic_code, sizeof(__magic_code));
+            ifile.write(&__version, sizeof(__version));
+        }
+        if(!ifile.good())
+        {
+            return false;
+        }
+        __isize = static_cast<int64_t>(ifile.tellp());
+    }
+    if(preallocate > 0)
+    {
+        __preallocated = utility::preallocate(fname + ".data", preallocate);
+    }
+    return true;
+}
+
+bool storage::sealed() const
+{
+    return __tl_cached;
+}
+
+bool storage::thin(const std::string file_name) const
+{
+    std::vector<index_info> gops;
+    std::vector<std::map<uint64_t, uint64_t>> tls;
+    {
+        std::unique_lock<std::mutex> lock(imtx);
+        gops = __gops;
+        tls = __timeline;
+    }
+    if(gops.empty() || tls.empty())
+    {
+        return false;
+    }
+    std::ifstream src(fname + ".data", std::ios::binary);
+    std::ofstream dfile(file_name + ".data", std::ios::binary | std::ios::trunc);
+    std::ofstream ifile(file_name + ".index", std::ios::binary | std::ios::trunc);
+    if(!src.is_open() || !dfile.is_open() || !ifile.is_open())
+    {
+        std::cerr<<"[VR] storage::thin() - open "<<file_name<<" failed"<<std::endl;
+        return false;
+    }
+    dfile.write(__magic_code, sizeof(__magic_code));
+    dfile.write(&__version, sizeof(__version));
+    ifile.write(__magic_code, sizeof(__magic_code));
+    ifile.write(&__version, sizeof(__version));
+
+    std::vector<char> frame;
+    for(auto& ii : gops)
+    {
+        size_t num_frames;
+        src.seekg(ii.loc);
+        if(!src.read((char *)&num_frames, sizeof(num_frames)))
+        {
+            return false;
+        }
+        size_t keep = ii.events ? num_frames : std::min<size_t>(num_frames, 1);
+        _LocKey loc = static_cast<_LocKey>(dfile.tellp());
+        dfile.write((char *)&keep, sizeof(keep));
+        for(size_t n = 0; n < keep; ++n)
+        {
+            // length, events and time stamp of the frame.
+            constexpr size_t hdr_size = sizeof(_LocKey) + sizeof(uint8_t) + sizeof(uint64_t);
+            char hdr[hdr_size];
+            if(!src.read(hdr, hdr_size))
+            {
+                return false;
+            }
+            _LocKey len = *reinterpret_cast<_LocKey *>(hdr);
+            frame.resize(len);
+            if(!src.read(frame.data(), len))
+            {
+                return false;
+            }
+            dfile.write(hdr, hdr_size);
+            dfile.write(frame.data(), len);
+        }
+        ifile.write((char *)&loc, sizeof(loc));
+        ifile.write((char *)&ii.events, sizeof(uint8_t));
+        ifile.write((char *)&ii.ts, sizeof(ii.ts));
+        ifile.write((char *)&ii.ts_end, sizeof(ii.ts_end));
+    }
+    if(!dfile.good() || !ifile.good())
+    {
+        return false;
+    }
+    int64_t index_size = static_cast<int64_t>(ifile.tellp());
+    dfile.close();
+    ifile.close();
+
+    std::error_code ec;
+    if(std::filesystem::exists(fname + ".extra", ec))
+    {
+        std::filesystem::copy_file(fname + ".extra", file_name + ".extra",
+            std::filesystem::copy_options::overwrite_existing, ec);
+        if(ec.value())
+        {
+            return false;
+        }
+    }
+    // timelines are the same as the original's.
+    return write_timeline_file(file_name, tls, __flags | __flag_thinned, index_size) >= 0;
+}
+
+bool storage::trim()
+{
+    namespace fs = std::filesystem;
+    if(__trimmed)
+    {
+        return true;
+    }
+    std::error_code ec;
+    if(fs::hard_link_count(fname + ".data", ec) != 1)
+    {
+        return false;
+    }
+    _LocKey first, last;
+    {
+        std::unique_lock<std::mutex> lock(imtx);
+        if(__gops.empty())
+        {
+            return false;
+        }
+        first = __gops.front().loc;
+        last = __gops.back().loc;
+    }
+    std::unique_lock<std::mutex> lock(dmtx);
+    std::ifstream dfile(fname + ".data", std::ios::binary);
+    // end of the last gop.
+    size_t num_frames;
+    dfile.seekg(last);
+    if(!dfile.read((char *)&num_frames, sizeof(num_frames)))
+    {
+        return false;
+    }
+    for(size_t n = 0; n < num_frames; ++n)
+    {
+        _LocKey len;
+        if(!dfile.read((char *)&len, sizeof(len)))
+        {
+            return false;
+        }
+        dfile.seekg(sizeof(uint8_t) + sizeof(uint64_t) + len, std::ios::cur);
+    }
+    _LocKey end = dfile.tellg();
+    dfile.close();
+    auto size = static_cast<_LocKey>(fs::file_size(fname + ".data", ec));
+    if(end <= 0 || ec.value())
+    {
+        return false;
+    }
+    constexpr _LocKey hdr_size = sizeof(__magic_code) + sizeof(__version);
+    __trimmed = utility::punch_hole(fname + ".data", hdr_size, first) &&
+        utility::punch_hole(fname + ".data", end, size);
+    return __trimmed;
+}
+
+bool storage::thinned() const
+{
+    return __flags & __flag_thinned;
+}
+
+bool storage::clip(const std::string file_name, uint64_t from, uint64_t to) const
+{
+    namespace fs = std::filesystem;
+    std::vector<index_info> gops;
+    _LocKey end_loc;
+    {
+        std::unique_lock<std::mutex> lock(imtx);
+        auto first = std::lower_bound(__gops.begin(), __gops.end(), from,
+            [](const index_info& ii, uint64_t t){ return uint64_t(ii.ts_end) < t; });
+        auto last = std::upper_bound(first, __gops.end(), to,
+            [](uint64_t t, const index_info& ii){ return t < uint64_t(ii.ts); });
+        if(first == last)
+        {
+            return false;
+        }
+        gops.assign(first, last);
+        end_loc = last == __gops.end() ? _LocKey(__dsize) : last->loc;
+    }
+    std::error_code ec;
+    if(!utility::create_directories(fs::path(file_name).parent_path().string(), ec))
+    {
+        return false;
+    }
+    for(auto ext : {".data", ".index", ".timeline", ".extra"})
+    {
+        fs::remove(file_name + ext, ec);
+    }
+    {
+        std::unique_lock<std::mutex> lock(dmtx);
+        {
+            std::ofstream dfile(file_name + ".data", std::ios::binary | std::ios::trunc);
+            dfile.write(__magic_code, sizeof(__magic_code));
+            dfile.write(&__version, sizeof(__version));
+            if(!dfile.good())
+            {
+                return false;
+            }
+        }
+        // gops keep their offsets, so the index needs no translation.
+        if(!utility::clone_range(fname + ".data", file_name + ".data", gops.front().loc, end_loc))
+        {
+            fs::remove(file_name + ".data", ec);
+            fs::create_hard_link(fname + ".data", file_name + ".data", ec);
+        }
+        if(ec.value())
+        {
+            // other file system, copy the range leaving a hole before it.
+            std::ifstream src(fname + ".data", std::ios::binary);
+            std::ofstream dfile(file_name + ".data", std::ios::binary | std::ios::trunc);
+            dfile.write(__magic_code, sizeof(__magic_code));
+            dfile.write(&__version, sizeof(__version));
+            src.seekg(gops.front().loc);
+            dfile.seekp(gops.front().loc);
+            std::vector<char> buf(1 << 20);
+            for(auto left = end_loc - gops.front().loc; left > 0;)
+            {
+                auto len = std::min<int64_t>(left, buf.size());
+                if(!src.read(buf.data(), len))
+                {
+                    return false;
+                }
+                dfile.write(buf.data(), len);
+                left -= len;
+            }
+            if(!dfile.good())
+            {
+                return false;
+            }
+        }
+    }
+    {
+        std::ofstream ifile(file_name + ".index", std::ios::binary | std::ios::trunc);
+        ifile.write(__magic_code, sizeof(__magic_code));
+        ifile.write(&__version, sizeof(__version));
+        for(auto& ii : gops)
+        {
+            ifile.write((char *)&ii.loc, sizeof(ii.loc));
+            ifile.write((char *)&ii.events, sizeof(uint8_t));
+            ifile.write((char *)&ii.ts, sizeof(ii.ts));
+            ifile.write((char *)&ii.ts_end, sizeof(ii.ts_end));
+        }
+        if(!ifile.good())
+        {
+            return false;
+        }
+    }
+    if(fs::exists(fname + ".extra", ec))
+    {
+        fs::copy_file(fname + ".extra", file_name + ".extra", ec);
+        if(ec.value())
+        {
+            return false;
+        }
+    }
+    // timelines of the clip.
+    storage clipped(file_name);
+    return clipped.seal();
+}
+
 std::string storage::name() const
 {
     return fname;
 }
 
+std::vector<std::string> storage::files() const
+{
+    std::vector<std::string> paths;
+    for(auto ext : {".data", ".index", ".timeline", ".extra"})
+    {
+        std::error_code ec;
+        if(std::filesystem::exists(fname + ext, ec))
+        {
+            paths.push_back(fname + ext);
+        }
+    }
+    return paths;
+}
+
 std::vector<std::pair<uint64_t, uint64_t>> storage::timeline(int index) const
 {
     std::vector<std::pair<uint64_t, uint64_t>> tl;
 
-    if(__max_events <= index)
+    if(__max_events < index)
     {
         return tl;
     }
     
+    std::unique_lock<std::mutex> lock(imtx);
+    if(__timeline.empty())
+    {
+        return tl;
+    }
     for(auto it : __timeline.at(index))
     {
         tl.push_back(std::make_pair(it.first, it.second));
@@ -97,13 +475,38 @@ std::vector<std::pair<uint64_t, uint64_t>> storage::timeline(int index) const
 
 std::pair<uint64_t, uint64_t> storage::recent_timeline(int index) const
 {
-    if(__max_events <= index) return std::make_pair(0, 0);
-    auto timeline = __timeline.at(index);
+    if(__max_events < index) return std::make_pair(0, 0);
+    std::unique_lock<std::mutex> lock(imtx);
+    if(__timeline.empty()) return std::make_pair(0, 0);
+    auto& timeline = __timeline.at(index);
     if(timeline.size() == 0) return std::make_pair(0, 0);
     auto it = std::prev(timeline.end());
     return std::make_pair(it->first, it->second);
 }
 
+std::pair<uint64_t, uint64_t> storage::span() const
+{
+    std::unique_lock<std::mutex> lock(imtx);
+    uint64_t from = UINT64_MAX;
+    uint64_t to = 0;
+    for(auto& tl : __timeline)
+    {
+        if(tl.empty())
+        {
+            continue;
+        }
+        from = std::min(from, tl.begin()->first);
+        to = std::max(to, std::prev(tl.end())->second);
+    }
+    if(from > to) return std::make_pair(0, 0);
+    return std::make_pair(from, to);
+}
+
+uint64_t storage::bytes() const
+{
+    return __dsize + __isize + __tsize + __esize;
+}
+
 bool storage::empty() const
 {
     return idxes.empty();
@@ -122,6 +525,7 @@ storage::iterator storage::find(std::time_t at)
     }
     rd.dfname = fname + ".data";
     rd.dmtx = &dmtx;
+    rd.strg = this;
     it.__iter = found;
     it.__rd = rd;
     return it;
@@ -133,6 +537,7 @@ storage::iterator storage::begin()
     reader rd;
     rd.dfname = fname + ".data";
     rd.dmtx = &dmtx;
+    rd.strg = this;
     it.__iter = idxes.begin();
     it.__rd = rd;
     return it;
@@ -144,6 +549,7 @@ storage::iterator storage::end()
     reader rd;
     rd.dfname = fname + ".data";
     rd.dmtx = &dmtx;
+    rd.strg = this;
     it.__iter = idxes.end();
     it.__rd = rd;
     return it;
@@ -189,7 +595,8 @@ bool storage::read_data_file(std::string file)
         
     while(data_file.peek() != EOF) {
         index_info ii;
-        ii.loc = data_file.tellg();;
+        ii.loc = data_file.tellg();
+        ii.events = 0;
 
         num_frames = 0;
         if(!data_file.read((char *)&num_frames, sizeof(_LocKey))) {
@@ -210,6 +617,7 @@ bool storage::read_data_file(std::string file)
                 return false;
             }
             
+            ii.events |= events;
             if(i == 0) ii.ts = frame_msec;
             if(i == num_frames-1) ii.ts_end = frame_msec;
             data_file.seekg(frame_size, std::ios::cur);
@@ -217,8 +625,130 @@ bool storage::read_data_file(std::string file)
 
         _LocKey idx_key = make_index_key(ii.ts / 1000);
         idxes[idx_key] = ii;
-        update_timeline(events, std::chrono::milliseconds(ii.ts), std::chrono::milliseconds(ii.ts_end));
+        update_event_index(ii);
+        update_timeline(ii.events, std::chrono::milliseconds(ii.ts), std::chrono::milliseconds(ii.ts_end));
+    }
+    return true;
+}
+
+int64_t storage::write_timeline_file(const std::string file,
+    const std::vector<std::map<uint64_t, uint64_t>>& tls,
+    uint8_t flags, int64_t index_size)
+{
+    std::error_code ec;
+    /*
+    * Layout of timeline file:
+    *   magic code(2), version(1), flags(1), size of index file(8),
+    *   and for each timeline: number of spans(4), spans(16 each).
+    */
+    utility::byte_buffer buf;
+    buf<<__magic_code[0]<<__magic_code[1]<<__timeline_version<<flags;
+    buf<<index_size;
+    for(auto& tl : tls)
+    {
+        buf<<static_cast<uint32_t>(tl.size());
+        for(auto& span : tl)
+        {
+            buf<<span.first<<span.second;
+        }
+    }
+
+    // write to a temporary file and rename it to keep it consistent.
+    std::string tmp_name = file + ".timeline.tmp";
+    {
+        std::ofstream tfile(tmp_name, std::ios::binary | std::ios::trunc);
+        if(!tfile.is_open())
+        {
+            std::cerr<<"[VR] storage::write_timeline_file() - open "<<tmp_name<<" failed"<<std::endl;
+            return -1;
+        }
+        tfile.write(buf.data(), buf.size());
+        if(!tfile.good())
+        {
+            tfile.close();
+            std::filesystem::remove(tmp_name, ec);
+            return -1;
+        }
+    }
+    std::filesystem::rename(tmp_name, file + ".timeline", ec);
+    if(ec.value())
+    {
+        std::filesystem::remove(tmp_name, ec);
+        return -1;
+    }
+    return static_cast<int64_t>(buf.size());
+}
+
+bool storage::read_timeline_file(std::string file)
+{
+    std::error_code ec;
+    auto index_size = static_cast<int64_t>(
+        std::filesystem::file_size(file + ".index", ec));
+    if(ec.value())
+    {
+        return false;
+    }
+    auto timeline_size = std::filesystem::file_size(file + ".timeline", ec);
+    if(ec.value())
+    {
+        return false;
+    }
+    std::ifstream tfile(file + ".timeline", std::ios::binary);
+    if(!tfile.is_open())
+    {
+        return false;
+    }
+
+    constexpr int hdr_size = 4;
+    char hdr[hdr_size];
+    int64_t recorded_size;
+    if(!tfile.read(hdr, hdr_size) ||
+        !tfile.read((char *)&recorded_size, sizeof(recorded_size)))
+    {
+        return false;
+    }
+    if(hdr[0] != __magic_code[0] || hdr[1] != __magic_code[1] ||
+        hdr[2] != __timeline_version)
+    {
+        return false;
+    }
+    // index file was appended after sealing.
+    if(recorded_size != index_size)
+    {
+        return false;
+    }
+
+    uint8_t flags = static_cast<uint8_t>(hdr[3]);
+    uint64_t left = timeline_size - std::min<uint64_t>(timeline_size,
+        hdr_size + sizeof(recorded_size));
+    std::vector<std::map<uint64_t, uint64_t>> tls(__max_events+1);
+    for(auto& tl : tls)
+    {
+        uint32_t num_spans;
+        if(!tfile.read((char *)&num_spans, sizeof(num_spans)))
+        {
+            return false;
+        }
+        left -= std::min<uint64_t>(left, sizeof(num_spans));
+        // a torn or corrupt file, not to allocate what it does not have.
+        uint64_t spans_size = uint64_t(num_spans) * 2 * sizeof(uint64_t);
+        if(spans_size > left)
+        {
+            return false;
+        }
+        left -= spans_size;
+        std::vector<uint64_t> spans(uint64_t(num_spans) * 2);
+        if(!tfile.read((char *)spans.data(), spans.size() * sizeof(uint64_t)))
+        {
+            return false;
+        }
+        for(uint32_t n = 0; n < num_spans; ++n)
+        {
+            tl.emplace_hint(tl.end(), spans[n*2], spans[n*2+1]);
+        }
     }
+    __timeline = std::move(tls);
+    __flags = flags;
     return true;
 }
 
@@ -281,7 +811,11 @@ bool storage::read_index_file(std::string file)
             last_ts = ii.ts_end;
             _LocKey idx_key = make_index_key(ii.ts / 1000);
             idxes[idx_key] = ii;
-            update_timeline(ii.events, std::chrono::milliseconds(ii.ts), std::chrono::milliseconds(ii.ts_end));
+            update_event_index(ii);
+            if(!__tl_cached)
+            {
+                update_timeline(ii.events, std::chrono::milliseconds(ii.ts), std::chrono::milliseconds(ii.ts_end));
+            }
         }
     }
     else
@@ -316,6 +850,11 @@ bool storage::write(const std::vector<frame_info>& data)
         }
     }
     
+    if(data[0].extradata && !write_extradata(at.count(), data[0].extradata))
+    {
+        return false;
+    }
+
     uint8_t events = 0;
     _LocKey data_loc;
     {
@@ -359,8 +898,10 @@ bool storage::write(const std::vector<frame_info>& data)
             dfile.write((char *)frame.data.data(), frame.data.size());
             events |= frame.events;
         }
+        __dsize = static_cast<int64_t>(dfile.tellp());
         dfile.close();
     }
+    identify();
     // write group of picture to data file.
     {
         std::unique_lock<std::mutex> lock(imtx);
@@ -396,21 +937,163 @@ bool storage::write(const std::vector<frame_info>& data)
         ifile.write((char *)&events, sizeof(uint8_t));
         ifile.write((char *)&ts, sizeof(ts));
         ifile.write((char *)&ts_end, sizeof(ts_end));
+        __isize = static_cast<int64_t>(ifile.tellp());
         ifile.close();
         idxes[idx_key] = index_info{data_loc, events, ts, ts_end};
+        update_event_index(idxes[idx_key]);
+        // timeline file is stale now.
+        __tl_cached = false;
     }
     return true;
 }
 
+std::vector<storage::gop_location> storage::search(
+    const event_query& query, uint64_t from, uint64_t to) const
+{
+    std::vector<gop_location> found;
+    std::unique_lock<std::mutex> lock(imtx);
+    if(__evt_idx.empty())
+    {
+        return found;
+    }
+    // gops are in time order, so the range is a range of ordinals.
+    auto first = std::lower_bound(__gops.begin(), __gops.end(), from,
+        [](const index_info& ii, uint64_t t){ return uint64_t(ii.ts_end) < t; });
+    auto last = std::upper_bound(first, __gops.end(), to,
+        [](uint64_t t, const index_info& ii){ return t < uint64_t(ii.ts); });
+    if(first == last)
+    {
+        return found;
+    }
+    auto matched = event_bitmap::range(
+        std::distance(__gops.begin(), first),
+        std::distance(__gops.begin(), last));
+    for(int bit = 0; bit < __max_events; ++bit)
+    {
+        if(query.all & (1 << bit))
+        {
+            matched = matched & __evt_idx[bit];
+        }
+    }
+    if(query.any)
+    {
+        event_bitmap any;
+        for(int bit = 0; bit < __max_events; ++bit)
+        {
+            if(query.any & (1 << bit))
+            {
+                any = any | __evt_idx[bit];
+            }
+        }
+        matched = matched & any;
+    }
+    for(int bit = 0; bit < __max_events; ++bit)
+    {
+        if(query.none & (1 << bit))
+        {
+            matched = matched.and_not(__evt_idx[bit]);
+        }
+    }
+    // ino first, dev is stored before it.
+    uint64_t ino = __data_ino;
+    uint64_t dev = __data_dev;
+    for(auto ordinal : matched.to_vector())
+    {
+        auto& ii = __gops[ordinal];
+        std::shared_ptr<const std::vector<uint8_t>> extradata;
+        auto extra = __extras.upper_bound(ii.ts);
+        if(extra != __extras.begin())
+        {
+            extradata = std::prev(extra)->second;
+        }
+        found.push_back({fname, ii.loc, ii.events, ii.ts, ii.ts_end, extradata,
+            dev, ino});
+    }
+    return found;
+}
+
+std::vector<storage::frame_range> storage::frame_ranges(int fd, const gop_location& gop)
+{
+    std::vector<frame_range> ranges;
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        std::cerr<<"[storage.cc, frame_ranges] ";
+        std::cerr<<"Fail to stat: "<<gop.file<<".data"<<std::endl;
+        return ranges;
+    }
+    int64_t dfile_size = st.st_size;
+    if(gop.loc < 0 || dfile_size <= gop.loc)
+    {
+        return ranges;
+    }
+    size_t num_frames = 0;
+    if(pread(fd, &num_frames, sizeof(size_t), gop.loc) != sizeof(size_t))
+    {
+        return ranges;
+    }
+    int64_t pos = gop.loc + sizeof(size_t);
+    constexpr int64_t header_size = sizeof(size_t) + sizeof(uint8_t) + sizeof(uint64_t);
+    char header[header_size];
+    for(size_t n = 0; n < num_frames; ++n)
+    {
+        size_t len;
+        uint8_t events;
+        uint64_t tl;
+        if(pread(fd, header, header_size, pos) != header_size)
+        {
+            return std::vector<frame_range>();
+        }
+        std::memcpy(&len, header, sizeof(size_t));
+        std::memcpy(&events, header + sizeof(size_t), sizeof(uint8_t));
+        std::memcpy(&tl, header + sizeof(size_t) + sizeof(uint8_t), sizeof(uint64_t));
+        pos += header_size;
+        if(len > uint64_t(dfile_size - pos))
+        {
+            // not a gop.
+            return std::vector<frame_range>();
+        }
+        ranges.push_back({pos, int64_t(len), milliseconds(tl), events});
+        pos += len;
+    }
+    return ranges;
+}
+
+void storage::update_event_index(const index_info& ii)
+{
+    uint32_t ordinal = __gops.size();
+    __gops.push_back(ii);
+    for(int bit = 0; bit < __max_events; ++bit)
+    {
+        if(ii.events & (1 << bit))
+        {
+            __evt_idx[bit].add(ordinal);
+        }
+    }
+}
+
+void storage::identify()
+{
+    if(__data_ino.load() != 0)
+    {
+        return;
+    }
+    struct stat st;
+    if(stat((fname + ".data").c_str(), &st) == 0)
+    {
+        __data_dev = uint64_t(st.st_dev);
+        __data_ino = uint64_t(st.st_ino);
+    }
+}
+
 storage::_IdxKey storage::make_index_key(const std::time_t time) const
 {
-    std::tm t;
-    //auto t = *gmtime(&time);
-    auto ptr = gmtime_r(&time, &t);
-    if(!ptr){
-        std::cerr<<"[VR] storage::make_index_key: gmtime_r(&time, &t)"<<std::endl;
+    if(time < __base_time)
+    {
+        std::cerr<<"[VR] storage::make_index_key: time before base time"<<std::endl;
+        return 0;
     }
-    return t.tm_min * 1e2 + t.tm_sec;
+    return static_cast<_IdxKey>(time - __base_time);
 }
 
 void storage::update_timeline(uint8_t events, milliseconds at, milliseconds end)
@@ -589,6 +1272,107 @@ bool storage::repair_if_corrupt(std::string file_name)
     return true;
 }
 
+bool storage::read_extra_file(std::string file)
+{
+    std::ifstream efile(file + ".extra", std::ios::binary);
+    if(!efile.is_open())
+    {
+        return false;
+    }
+    constexpr int hdr_size = 3;
+    char hdr[hdr_size];
+    if(!efile.read(hdr, hdr_size) ||
+        hdr[0] != __magic_code[0] || hdr[1] != __magic_code[1] || hdr[2] != __version)
+    {
+        std::cerr<<"[VR] storage::read_extra_file() - invalid header: "<<file<<".extra"<<std::endl;
+        return false;
+    }
+    // entries of time stamp(8), length(8) and extradata.
+    _TsKey ts;
+    int64_t len;
+    while(efile.read((char *)&ts, sizeof(ts)) && efile.read((char *)&len, sizeof(len)))
+    {
+        // extradata is a few parameter sets, a larger one is corrupt.
+        if(len < 0 || len > (1 << 20))
+        {
+            break;
+        }
+        auto extradata = std::make_shared<std::vector<uint8_t>>(len);
+        if(!efile.read((char *)extradata->data(), len))
+        {
+            // torn entry at the end.
+            break;
+        }
+        __extras[ts] = extradata;
+    }
+    return true;
+}
+
+bool storage::write_extradata(_TsKey ts,
+    const std::shared_ptr<const std::vector<uint8_t>>& extradata)
+{
+    std::unique_lock<std::mutex> lock(imtx);
+    if(!__extras.empty())
+    {
+        auto& last = std::prev(__extras.end())->second;
+        if(last == extradata || *last == *extradata)
+        {
+            return true;
+        }
+    }
+    std::string efile_name = fname + ".extra";
+    std::error_code ec;
+    std::filesystem::create_directories(
+        std::filesystem::path(efile_name).parent_path(), ec);
+    std::ofstream efile(efile_name, std::ios::binary | std::ios::app);
+    if(!efile.is_open())
+    {
+        std::cerr<<"[VR] storage::write_extradata() - open "<<efile_name<<" failed"<<std::endl;
+        return false;
+    }
+    efile.seekp(0, std::ios::end);
+    if(efile.tellp() == 0)
+    {
+        efile.write(__magic_code, sizeof(__magic_code));
+        efile.write(&__version, sizeof(__version));
+    }
+    int64_t len = extradata->size();
+    efile.write((char *)&ts, sizeof(ts));
+    efile.write((char *)&len, sizeof(len));
+    efile.write((char *)extradata->data(), len);
+    if(!efile.good())
+    {
+        return false;
+    }
+    __esize = static_cast<int64_t>(efile.tellp());
+    __extras[ts] = extradata;
+    return true;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> storage::extradata_at(_TsKey ts) const
+{
+    std::unique_lock<std::mutex> lock(imtx);
+    auto it = __extras.upper_bound(ts);
+    if(it == __extras.begin())
+    {
+        return nullptr;
+    }
+    return std::prev(it)->second;
+}
+
+std::vector<uint8_t> storage::with_extradata(const frame_info& fi)
+{
+    if(!fi.extradata)
+    {
+        return fi.data;
+    }
+    std::vector<uint8_t> data;
+    data.reserve(fi.extradata->size() + fi.data.size());
+    data.insert(data.end(), fi.extradata->begin(), fi.extradata->end());
+    data.insert(data.end(), fi.data.begin(), fi.data.end());
+    return data;
+}
+
 std::vector<storage::frame_info> storage::reader::operator()(index_info ii)
 {
     std::vector<frame_info> data;
@@ -645,10 +1429,14 @@ std::vector<storage::frame_info> storage::reader::operator()(index_info ii)
             reinterpret_cast<char *>(fr.data()),
             len
         );
-        data.push_back({fr, milliseconds(tl), events});
+        data.push_back({fr, milliseconds(tl), events, nullptr});
     }
     
     dfile.close();
+    if(!data.empty())
+    {
+        data.front().extradata = strg->extradata_at(ii.ts);
+    }
     return data;
 }
 
@@ -1,14 +1,21 @@
 #pragma once
+#include "vr/recorder/event_bitmap.h"
 #include <fstream>
 #include <mutex>
 #include <map>
 #include <vector>
 #include <chrono>
+#include <ctime>
+#include <atomic>
+#include <memory>
 
 namespace vr
 {
 constexpr static char __version = 0x01;
 constexpr static char __magic_code[2] = {'t', 'p'};
+constexpr static char __timeline_version = 0x01;
+// 2020-01-01 00:00:00 UTC, base of storage and index keys.
+constexpr static std::time_t __base_time = 1577836800;
 
 using namespace std::chrono;
 
@@ -35,14 +42,14 @@ class storage
     // file name excluding extension.
     std::string fname;
     // mutex for data file stream.
-    std::mutex dmtx;
-    // mutex for index file stream.
-    std::mutex imtx;
+    mutable std::mutex dmtx;
+    // mutex for index file stream and timelines.
+    mutable std::mutex imtx;
 
     /*
     * Key(_IdxKey) of the map is
-        a value concatenated with minute-second.
-    * It has upto 4 position. Minute(2), Second(2).
+        seconds elapsed since __base_time,
+        so a storage can span any duration.
     * Value of the map is index_info.
     * See above index_info structure.
     */
@@ -50,13 +57,98 @@ class storage
 
     std::vector<std::map<uint64_t, uint64_t>> __timeline;
 
+    // all gops in written order, position is the ordinal of a gop.
+    std::vector<index_info> __gops;
+
+    // gop ordinals for each event bit.
+    std::vector<event_bitmap> __evt_idx;
+
+    // true if __timeline was loaded from a valid timeline file.
+    bool __tl_cached = false;
+
+    // true if disk blocks were reserved past the end of the data file.
+    bool __preallocated = false;
+
+    // true if trim() freed blocks outside gops.
+    bool __trimmed = false;
+
+    // flags recorded in the timeline file.
+    uint8_t __flags = 0;
+
+    /*
+    * Codec extradata(SPS/PPS) by the time(ms) it took effect.
+    * It is written to the extra file once per change,
+    * not with every key frame.
+    */
+    std::map<_TsKey, std::shared_ptr<const std::vector<uint8_t>>> __extras;
+
+    // size of data, index, timeline and extra file in bytes.
+    std::atomic<int64_t> __dsize{0};
+    std::atomic<int64_t> __isize{0};
+    std::atomic<int64_t> __tsize{0};
+    std::atomic<int64_t> __esize{0};
+
+    // device and inode of the data file, 0 until it exists.
+    // set while the storage owns the name, not to take a file renamed over it.
+    std::atomic<uint64_t> __data_dev{0};
+    std::atomic<uint64_t> __data_ino{0};
+
 public:
     constexpr static int __max_events = 8;
+    // gops without events keep their first frame only.
+    constexpr static uint8_t __flag_thinned = 0x01;
     struct frame_info
     {
         std::vector<uint8_t> data;
         milliseconds msec;
         uint8_t events;
+        // codec extradata for the first frame of a gop, nullptr if not known.
+        // shared by all gops until it changes.
+        std::shared_ptr<const std::vector<uint8_t>> extradata;
+    };
+
+    // data of the frame prefixed by its extradata,
+    // for consumers which need self-contained key frames.
+    static std::vector<uint8_t> with_extradata(const frame_info& fi);
+
+    // boolean query on event bits of gops.
+    struct event_query
+    {
+        // all of these bits must be set.
+        uint8_t all = 0;
+        // one of these bits must be set, ignored if zero.
+        uint8_t any = 0;
+        // none of these bits may be set.
+        uint8_t none = 0;
+    };
+
+    // location of a gop found by search.
+    struct gop_location
+    {
+        // file name excluding extension.
+        std::string file;
+        // location of group of picture in data file.
+        int64_t loc;
+        uint8_t events;
+        int64_t ts;
+        int64_t ts_end;
+        // codec extradata in effect for the gop, nullptr if not known.
+        std::shared_ptr<const std::vector<uint8_t>> extradata;
+        // device and inode of the data file the gop was found in, 0 if not known.
+        // a file rewritten under the name(e.g. thinned) is another file,
+        // loc means nothing in it.
+        uint64_t dev;
+        uint64_t ino;
+    };
+
+    // payload of a frame in a data file.
+    struct frame_range
+    {
+        // offset of the payload, past the frame header.
+        int64_t offset;
+        int64_t size;
+        milliseconds msec;
+        uint8_t events;
     };
 
     class iterator;
@@ -70,17 +162,64 @@ public:
     void close();
 
     bool remove();
+
+    // write merged timelines to the timeline file.
+    // call it when no more gop will be written to this storage.
+    bool seal();
+
+    // create empty data and index files ahead of the first write,
+    // reserving disk blocks for the data file.
+    bool prepare(int64_t preallocate);
+
+    // true if the timeline file matches the index file.
+    bool sealed() const;
+
+    // write a sealed copy of this storage to the file name(excluding extension),
+    // keeping only the first(key) frame of gops without events.
+    // index of the copy keeps time stamps of the original gops,
+    // so timelines and search results do not change.
+    bool thin(const std::string file_name) const;
+
+    // true if this storage is a thinned copy.
+    bool thinned() const;
+
+    // write a sealed storage of gops between from and to(ms)
+    // to the file name(excluding extension).
+    // its data file shares disk blocks with this storage by a reflink
+    // or a hard link if possible, and keeps gops at the same offsets.
+    bool clip(const std::string file_name, uint64_t from, uint64_t to) const;
+
+    // free disk blocks of the data file outside its gops,
+    // if no other file links to it. e.g. a clip made by a hard link.
+    bool trim();
     
     std::string name() const;
+
+    // paths of existing files of this storage.
+    std::vector<std::string> files() const;
     
     std::vector<std::pair<uint64_t, uint64_t>> timeline(int index) const;
 
     std::pair<uint64_t, uint64_t> recent_timeline(int index) const;
 
+    // time range covered by all timelines, (0, 0) if empty.
+    std::pair<uint64_t, uint64_t> span() const;
+
+    // bytes of all files of this storage on disk.
+    uint64_t bytes() const;
+
     bool empty() const;
 
     bool write(const std::vector<frame_info>& data);
 
+    // gops between from and to(ms) matching the query.
+    std::vector<gop_location> search(
+        const event_query& query, uint64_t from, uint64_t to) const;
+
+    // payload ranges of the frames of a found gop in its open data file,
+    // reading frame headers only. empty if the gop is not there.
+    static std::vector<frame_range> frame_ranges(int fd, const gop_location& gop);
+
     iterator find(std::time_t at);
 
     iterator begin();
@@ -92,9 +231,29 @@ private:
 
     bool read_index_file(std::string file);
     bool read_data_file(std::string file);
+    bool read_timeline_file(std::string file);
+    bool read_extra_file(std::string file);
+
+    // append the extradata to the extra file if it changed.
+    bool write_extradata(_TsKey ts,
+        const std::shared_ptr<const std::vector<uint8_t>>& extradata);
+
+    // extradata in effect at the time(ms), nullptr if none.
+    std::shared_ptr<const std::vector<uint8_t>> extradata_at(_TsKey ts) const;
+
+    // write timelines to the timeline file of the file name(excluding extension),
+    // returns bytes written or -1 on failure.
+    static int64_t write_timeline_file(const std::string file,
+        const std::vector<std::map<uint64_t, uint64_t>>& tls,
+        uint8_t flags, int64_t index_size);
 
     void update_timeline(uint8_t event, milliseconds at, milliseconds end);
 
+    void update_event_index(const index_info& ii);
+
+    // record the identity of the data file once it exists.
+    void identify();
+
     bool repair_if_corrupt(std::string file_name);
 };
 
@@ -104,6 +263,7 @@ class storage::reader
 
     std::string dfname;
     std::mutex* dmtx;
+    const storage* strg;
 
 public:
     std::vector<frame_info> operator()(index_info ii);
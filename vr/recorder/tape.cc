@@ -2,14 +2,17 @@
 #include "vr/utility/handy.h"
 #include <filesystem>
 #include <sstream>
-#include <regex>
 #include <iomanip>
+#include <algorithm>
 #include <iostream>
 
 namespace vr
 {
 const std::string tape::FILE_NAME_REGEX =
-    "^(\\d{4}-\\d{2}-\\d{2}@\\d{2}-\\d{2}-\\d{2})\\.(index|data)";
+    "^(\\d{4}-\\d{2}-\\d{2}@\\d{2}-\\d{2}-\\d{2})\\.(index|data|timeline|extra)";
+const std::vector<std::string> tape::FILE_EXTENSIONS = {
+    "index", "data", "timeline", "extra"};
+const std::string tape::PIN_DIR = "pins";
 
 tape::~tape()
 {
@@ -18,39 +21,94 @@ tape::~tape()
 
 bool tape::open(const std::string dir, option opt)
 {
-    std::vector<std::string> to_remove;
     _root = dir;
     __opt = opt;
     restrict_option();
-    if(__opt.remove_previous)
+    std::vector<std::string> dirs = {dir};
+    for(auto& t : __opt.tiers)
+    {
+        dirs.push_back(t.dir);
+    }
+    if(__volumes)
     {
-        auto all_strgs = utility::get_matched_file_list(dir, FILE_NAME_REGEX);
-        for(auto& it : all_strgs)
+        auto name = std::filesystem::path(dir).filename();
+        for(auto& root : __volumes->roots())
         {
-            to_remove.insert(to_remove.end(),
-                it.second.begin(), it.second.end());
+            auto d = (std::filesystem::path(root) / name).string();
+            if(std::find_if(dirs.begin(), dirs.end(), [&d](const std::string& x){
+                    return std::filesystem::path(x) == std::filesystem::path(d);
+                }) == dirs.end())
+            {
+                dirs.push_back(d);
+            }
         }
     }
-    else
+    // clips are not subject to retention, keep them out of dirs.
+    auto pin_dir = (std::filesystem::path(dir) / PIN_DIR).string();
+    for(auto& d : dirs)
+    {
+        std::error_code ec;
+        auto cat = std::make_shared<utility::catalog>(
+            FILE_EXTENSIONS, std::vector<std::string>{PIN_DIR});
+        if(!utility::create_directories(d, ec) || !cat->open(d))
+        {
+            std::cerr<<"[VR] tape::open: Failed to open "<<d<<std::endl;
+            return false;
+        }
+        __catalogs[d] = cat;
+    }
     {
-        auto old_files = get_old_files(_root, __opt.max_days);
-        to_remove.insert(to_remove.end(),
-            old_files.begin(), old_files.end());
+        std::error_code ec;
+        auto cat = std::make_shared<utility::catalog>(FILE_EXTENSIONS);
+        if(!utility::create_directories(pin_dir, ec) || !cat->open(pin_dir))
+        {
+            std::cerr<<"[VR] tape::open: Failed to open "<<pin_dir<<std::endl;
+            return false;
+        }
+        __catalogs[pin_dir] = cat;
     }
-    auto failed = utility::remove_files(to_remove, dir);
-    if(!failed.empty())
+    if(!__deleter)
     {
-        std::cerr<<"[VR] fail to remove files below:"<<std::endl;
-        std::for_each(failed.begin(), failed.end(),[](std::string s){
-                std::cerr<<"    "<<s<<std::endl;
-        });
+        __deleter = std::make_shared<utility::file_deleter>();
+    }
+    for(auto& d : dirs)
+    {
+        std::vector<std::string> to_remove;
+        if(__opt.remove_previous)
+        {
+            auto all_strgs = __catalogs[d]->list();
+            for(auto& it : all_strgs)
+            {
+                for(auto& f : it.second)
+                {
+                    std::filesystem::path fullpath = d;
+                    to_remove.push_back(fullpath / f);
+                }
+            }
+        }
+        else
+        {
+            to_remove = get_old_files(d, __opt.max_days);
+        }
+        // forget them now, the deleter removes them later.
+        for(auto& f : to_remove)
+        {
+            __catalogs[d]->erase(f);
+        }
+        __deleter->remove(to_remove);
     }
 
-
-    if(!aggregate_index(_root))
+    if(!aggregate_index(dirs))
     {
         return false;
     }
+    load_pins();
+    // storages are tracked in strgs from now on, the scans are not needed.
+    for(auto& it : __catalogs)
+    {
+        it.second->close();
+    }
+    __catalogs.clear();
     __stop = false;
     __write_worker = std::thread(
         [this]()
@@ -74,12 +132,27 @@ bool tape::open(const std::string dir, option opt)
                 std::shared_ptr<storage> strg = find_storage(sec);
                 if(!strg)
                 {
-                    auto try_key = make_storage_key(sec);
+                    // rolling over to the prepared segment is a pointer swap.
+                    strg = take_prepared(sec);
+                }
+                if(!strg)
+                {
                     strg = create_storage(sec);
-                    if(!remove_oldest_storage())
+                }
+                if(strg && strg != __live)
+                {
+                    std::unique_lock<std::mutex> lock(__tlmtx);
+                    // previous storage will not be written anymore,
+                    // __prep_worker seals it.
+                    if(__live)
                     {
-                        // fail to remove oldest storage.
+                        {
+                            std::unique_lock<std::mutex> bg_lock(__bgmtx);
+                            __unsealed.push_back(__live);
+                        }
+                        __bgcv.notify_all();
                     }
+                    __live = strg;
                 }
                 if(strg)
                 {
@@ -95,9 +168,66 @@ bool tape::open(const std::string dir, option opt)
                     }
                     else
                     {
-                        strg->write(gop);
+                        auto before = strg->bytes();
+                        auto started = steady_clock::now();
+                        if(strg->write(gop))
+                        {
+                            index_gop(gop);
+                        }
+                        if(__volumes)
+                        {
+                            __volumes->record_write(strg->name(), duration_cast<microseconds>(
+                                steady_clock::now() - started), strg->bytes() - before);
+                        }
+                        __bytes += strg->bytes() - before;
+                        __written += strg->bytes() - before;
+                    }
+                }
+            }
+        }
+    );
+    __bg_stop = false;
+    __bg_worker = std::thread(
+        [this]()
+        {
+            while(true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(__bgmtx);
+                    __bgcv.wait_for(lock,
+                        std::chrono::seconds(BACKGROUND_INTERVAL_SEC),
+                        [this](){return __bg_stop;});
+                    if(__bg_stop)
+                    {
+                        break;
                     }
                 }
+                if(!remove_oldest_storage())
+                {
+                    // fail to remove oldest storage.
+                }
+                migrate();
+                thin();
+                release_retired();
+                trim_pins();
+            }
+        }
+    );
+    __prep_worker = std::thread(
+        [this]()
+        {
+            while(true)
+            {
+                seal_pending();
+                prepare_next();
+                std::unique_lock<std::mutex> lock(__bgmtx);
+                __bgcv.wait_for(lock,
+                    std::chrono::seconds(PREPARE_INTERVAL_SEC),
+                    [this](){return __bg_stop || !__unsealed.empty();});
+                if(__bg_stop)
+                {
+                    break;
+                }
             }
         }
     );
@@ -106,18 +236,68 @@ bool tape::open(const std::string dir, option opt)
 
 void tape::close()
 {
+    {
+        std::unique_lock<std::mutex> lock(__bgmtx);
+        __bg_stop = true;
+    }
+    __bgcv.notify_all();
+    if(__bg_worker.joinable())
+    {
+        __bg_worker.join();
+    }
+    if(__prep_worker.joinable())
+    {
+        __prep_worker.join();
+    }
     __stop = true;
     __wcv.notify_one();
     if(__write_worker.joinable())
     {
         __write_worker.join();
     }
+    seal_pending();
+    if(__next)
+    {
+        // prepared but not written.
+        dispose(__next);
+        __next = nullptr;
+    }
+    {
+        std::unique_lock<std::mutex> lock(__tlmtx);
+        if(__live)
+        {
+            auto before = __live->bytes();
+            __live->seal();
+            __bytes += __live->bytes() - before;
+            __live = nullptr;
+        }
+    }
+    for(auto& strg : __retired)
+    {
+        dispose(strg);
+    }
+    __retired.clear();
+    for(auto& it : __catalogs)
+    {
+        it.second->close();
+    }
+    __catalogs.clear();
     for(auto it : strgs)
     {
         it.second->close();
     }
 }
 
+void tape::set_deleter(std::shared_ptr<utility::file_deleter> deleter)
+{
+    __deleter = deleter;
+}
+
+void tape::set_volumes(std::shared_ptr<volume_set> volumes)
+{
+    __volumes = volumes;
+}
+
 bool tape::update_option(option opt)
 {
     std::unique_lock<std::mutex> lock(__wmtx);
@@ -125,14 +305,16 @@ bool tape::update_option(option opt)
     restrict_option();
     if(__opt.remove_previous)
     {
+        std::unique_lock<std::mutex> strg_lock(__smtx);
         for(auto it : strgs)
         {
-            if(!it.second->remove())
-            {
-                std::cerr<<"[VR] fail to remove "<<it.second->name()<<std::endl;
-            }
+            dispose(it.second);
         }
         strgs.clear();
+        __bytes = 0;
+        std::unique_lock<std::mutex> tl_lock(__tlmtx);
+        __tl_index.clear();
+        __live = nullptr;
     }
     else
     {
@@ -156,83 +338,216 @@ bool tape::write(std::vector<storage::frame_info> gop)
 
 std::vector<std::pair<uint64_t, uint64_t>> tape::timeline(int index)
 {
-    std::vector<std::pair<uint64_t, uint64_t>> tls;
-    for(auto it : strgs)
+    return timeline(index, 0, UINT64_MAX);
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> tape::timeline(
+    int index, uint64_t from, uint64_t to)
+{
+    std::unique_lock<std::mutex> lock(__tlmtx);
+    return __tl_index.query(index, from, to);
+}
+
+size_t tape::count(int index, uint64_t from, uint64_t to)
+{
+    std::unique_lock<std::mutex> lock(__tlmtx);
+    return __tl_index.count(index, from, to);
+}
+
+uint64_t tape::coverage(int index, uint64_t from, uint64_t to)
+{
+    std::unique_lock<std::mutex> lock(__tlmtx);
+    return __tl_index.coverage(index, from, to);
+}
+
+std::shared_ptr<std::pair<uint64_t, uint64_t>> tape::recent_timeline(int index)
+{
+    std::unique_lock<std::mutex> lock(__tlmtx);
+    auto tl = __tl_index.back(index);
+    if(tl.second == 0) return nullptr;
+    return std::make_shared<std::pair<uint64_t, uint64_t>>(tl);
+}
+
+bool tape::is_recording(milliseconds within) const
+{
+    auto now = duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch()).count();
+    auto last = __last_written.load(std::memory_order_relaxed);
+    return last != 0 && now - int64_t(last) <= within.count();
+}
+
+uint64_t tape::bytes() const
+{
+    return __bytes;
+}
+
+uint64_t tape::written() const
+{
+    return __written;
+}
+
+int64_t tape::oldest_time(const std::string& root)
+{
+    std::unique_lock<std::mutex> lock(__smtx);
+    auto oldest = oldest_unpinned(root);
+    if(oldest == strgs.end())
     {
-        auto cur_tl = it.second->timeline(index);
-        for(auto& tl : cur_tl)
-        {
-            tls.push_back(tl);
-        }
+        return -1;
     }
-    return merge_timeline(tls);
-    // return tls;
+    return static_cast<int64_t>(oldest->second->span().first);
 }
 
-std::shared_ptr<std::pair<uint64_t, uint64_t>> tape::recent_timeline(int index)
+bool tape::remove_oldest(const std::string& root)
+{
+    std::unique_lock<std::mutex> lock(__smtx);
+    auto oldest = oldest_unpinned(root);
+    if(oldest == strgs.end())
+    {
+        return false;
+    }
+    remove_storage(oldest);
+    return true;
+}
+
+std::vector<storage::gop_location> tape::search(
+    const storage::event_query& query, uint64_t from, uint64_t to)
 {
-    auto tls = timeline(index);
-    if(tls.size() == 0) return nullptr;
-    auto tl = tls.rbegin();
-    if(tl->second == 0) return nullptr;
-    return std::make_shared<std::pair<uint64_t, uint64_t>>(*tl);
+    std::vector<storage::gop_location> found;
+    if(from > to)
+    {
+        return found;
+    }
+    // keep time_t in range.
+    constexpr uint64_t max_sec = INT32_MAX + uint64_t(__base_time);
+    std::vector<std::shared_ptr<storage>> targets;
+    {
+        std::unique_lock<std::mutex> lock(__smtx);
+        // the storage started before from may have it.
+        auto first = strgs.upper_bound(
+            make_storage_key(std::min(from / 1000, max_sec)));
+        if(first != strgs.begin())
+        {
+            first = std::prev(first);
+        }
+        auto last = strgs.upper_bound(
+            make_storage_key(std::min(to / 1000, max_sec)));
+        for(auto it = first; it != last; ++it)
+        {
+            targets.push_back(it->second);
+        }
+    }
+    for(auto& strg : targets)
+    {
+        auto gops = strg->search(query, from, to);
+        found.insert(found.end(), gops.begin(), gops.end());
+    }
+    return found;
 }
 
 tape::iterator tape::find(std::time_t at)
 {
     iterator it;
     auto strg_key = make_storage_key(at);
-    auto strg_it = strgs.find(strg_key);
-    if(strg_it == strgs.end())
     {
-        return end();
+        std::unique_lock<std::mutex> lock(__smtx);
+        // the storage having the time, or the next one if none has.
+        auto strg_it = strgs.upper_bound(strg_key);
+        if(strg_it != strgs.begin())
+        {
+            auto prev_it = std::prev(strg_it);
+            auto recorded = prev_it->second->span().second / 1000;
+            if(strg_it == strgs.end() || uint64_t(at) <= recorded)
+            {
+                strg_it = prev_it;
+            }
+        }
+        if(strg_it == strgs.end())
+        {
+            return end();
+        }
+        it.__tp = this;
+        it.__key = strg_it->first;
+        it.__strg = strg_it->second;
     }
-    it.__strg = strg_it->second;
-    it.__iter = strg_it;
-    it.__iter_end = strgs.end();
-    it.__idx_iter = strg_it->second->find(at);
+    it.__idx_iter = it.__strg->find(at);
     return ++it;
 }
 
 tape::iterator tape::end()
 {
-    iterator it;
-    it.__iter = strgs.end();
-    return it;
+    return iterator();
 }
 
-bool tape::aggregate_index(const std::string dir)
+bool tape::aggregate_index(const std::vector<std::string> dirs)
 {
-    std::error_code ec;
-    if(!utility::create_directories(dir, ec))
-    {
-        std::cerr<<"[VR] tape::aggregate_index: Failed to create directories."<<std::endl;
-        // std::cerr<<'\t'<<dir<<std::endl;
-        // std::cerr<<'\t'<<std::filesystem::path(dir).parent_path()<<std::endl;
-        // std::cerr<<'\t'<<"error code: "<<ec.value()<<", "<<ec.message()<<std::endl;
-        return false;
-    }
-    auto strg_list = utility::get_matched_file_list(dir, FILE_NAME_REGEX);
-    for(auto& it : strg_list)
+    for(auto& dir : dirs)
     {
-        if(it.second.size() == 2)
+        auto strg_list = __catalogs[dir]->list();
+        for(auto& it : strg_list)
         {
+            auto has = [&it](std::string ext){
+                return std::find(it.second.begin(), it.second.end(),
+                    it.first + ext) != it.second.end();
+            };
+            if(!has(".index") || !has(".data"))
+            {
+                continue;
+            }
             std::tm t;
             strptime(it.first.c_str(), "%Y-%m-%d@%H-%M-%S", &t);
-            auto strg = create_storage(timegm(&t));
-            
+            if(strgs.count(make_storage_key(timegm(&t))))
+            {
+                // left by an interrupted migration, keep the warmer one.
+                std::vector<std::string> dup;
+                for(auto& f : it.second)
+                {
+                    dup.push_back((std::filesystem::path(dir) / f).string());
+                    __catalogs[dir]->erase(f);
+                }
+                __deleter->remove(dup);
+                continue;
+            }
+            auto strg = create_storage(timegm(&t), dir);
+
             if(strg->empty())
             {
-                std::cerr<<"[VR] fail to read: "<<dir+"/"+it.first<<std::endl;
                 auto strg_key = make_storage_key(timegm(&t));
                 auto strg_it = strgs.find(strg_key);
                 if(strg_it != strgs.end())
                 {
                     strgs.erase(strg_it);
                 }
+                // a prepared segment never written, only file headers.
+                constexpr uint64_t headers = 2 * (sizeof(__magic_code) + sizeof(__version));
+                if(strg->bytes() <= headers)
+                {
+                    dispose(strg);
+                    continue;
+                }
+                std::cerr<<"[VR] fail to read: "<<dir+"/"+it.first<<std::endl;
+            }
+        }
+    }
+    // seal old storages which have no timeline file yet,
+    // the most recent one may still be written.
+    if(!strgs.empty())
+    {
+        for(auto it = strgs.begin(); it != std::prev(strgs.end()); ++it)
+        {
+            if(!it->second->sealed())
+            {
+                it->second->seal();
             }
         }
     }
+    std::unique_lock<std::mutex> lock(__tlmtx);
+    uint64_t total = 0;
+    for(auto& it : strgs)
+    {
+        index_timeline(it.second);
+        total += it.second->bytes();
+    }
+    __bytes = total;
     return true;
 }
 
@@ -254,10 +569,9 @@ std::vector<std::pair<uint64_t, uint64_t>> tape::merge_timeline(
     while(next_it != tls.end())
     {
         auto pivot_it = std::prev(merged.end());
-        auto junction_diff = next_it->first - (pivot_it->second);
-        if(junction_diff <= 1500)
+        if(next_it->first <= pivot_it->second + 1500)
         {
-            pivot_it->second = next_it->second;
+            pivot_it->second = std::max(pivot_it->second, next_it->second);
             ++next_it;
         }
         else
@@ -271,128 +585,785 @@ std::vector<std::pair<uint64_t, uint64_t>> tape::merge_timeline(
 
 tape::_StrgKey tape::make_storage_key(const std::time_t time) const
 {
-    std::tm t;
-    //auto t = *gmtime(&time);
-    auto ptr = gmtime_r(&time, &t);
-    if(!ptr){
-        std::cerr<<"[VR] tape::make_storage_key: gmtime_r(&time, &t)"<<std::endl;
-    }
-    return (t.tm_year - (tape::BASE_YEAR - SYSTEM_BASE_YEAR)) * 1e5 +
-        t.tm_yday * 1e2 +
-        t.tm_hour;
+    auto key = int64_t(time) - int64_t(__base_time);
+    return static_cast<_StrgKey>(std::min<int64_t>(key, INT32_MAX));
+}
+
+std::time_t tape::segment_slot(const std::time_t time) const
+{
+    std::time_t len = std::time_t(__opt.segment_minutes) * 60;
+    return time - time % len;
 }
 
 std::shared_ptr<storage> tape::find_storage(const std::time_t time)
 {
+    std::unique_lock<std::mutex> lock(__smtx);
     auto strg_key = make_storage_key(time);
-    auto strg_it = strgs.find(strg_key);
-    if(strg_it == strgs.end())
+    auto strg_it = strgs.upper_bound(strg_key);
+    if(strg_it == strgs.begin())
+    {
+        return nullptr;
+    }
+    strg_it = std::prev(strg_it);
+    // time of the gop passed over the segment.
+    auto strg_time = std::time_t(strg_it->first) + __base_time;
+    if(segment_slot(strg_time) != segment_slot(time))
+    {
+        return nullptr;
+    }
+    // the segment is full.
+    if(__opt.max_segment_bytes > 0 &&
+        strg_it->second->bytes() >= __opt.max_segment_bytes)
     {
         return nullptr;
     }
     return strg_it->second;
 }
 
+std::string tape::storage_dir()
+{
+    auto root = __volumes ? __volumes->pick() : std::string();
+    if(root.empty())
+    {
+        return _root;
+    }
+    auto name = std::filesystem::path(_root).filename();
+    return (std::filesystem::path(root) / name).string();
+}
+
 std::shared_ptr<storage> tape::create_storage(const std::time_t time)
+{
+    return create_storage(time, storage_dir());
+}
+
+std::shared_ptr<storage> tape::create_storage(
+    const std::time_t time, const std::string dir)
 {
     auto strg_key = make_storage_key(time);
     if(strg_key < 0){return std::make_shared<storage>();}
-    auto strg = std::make_shared<storage>(make_file_name(time));
+    std::unique_lock<std::mutex> lock(__smtx);
+    auto strg_it = strgs.find(strg_key);
+    if(strg_it != strgs.end())
+    {
+        // rolled over by size within a second.
+        return strg_it->second;
+    }
+    auto strg = std::make_shared<storage>(make_file_name(time, dir));
     strgs[strg_key] = strg;
+    __bytes += strg->bytes();
     return strg;
 }
 
 bool tape::remove_oldest_storage()
 {
-    for(int n = 0; n < strgs.size(); ++n)
+    std::unique_lock<std::mutex> lock(__smtx);
+    while(strgs.size() > 1)
     {
-        auto oldest_strg_it = strgs.begin();
-        auto recent_strg_it = std::prev(strgs.end());
-        auto day_diff = recent_strg_it->first - oldest_strg_it->first;
-        if(day_diff >= __opt.max_days * 100)
-        {
-            //std::cerr<<"Trying delete..."<<std::endl;
-            //std::cerr<<"    oldest day : "<<oldest_strg_it->first<<std::endl;
-            //std::cerr<<"    recent day : "<<recent_strg_it->first<<std::endl;
-            //std::cerr<<"    diff       : "<<day_diff<<std::endl;
-            //std::cerr<<"    max days   : "<<__opt.max_days * 100<<std::endl;
-            if(!oldest_strg_it->second->remove())
-            {
-                std::cerr<<"Trying delete..."<<std::endl;
-                std::cerr<<"    oldest day : "<<oldest_strg_it->first<<std::endl;
-                std::cerr<<"    recent day : "<<recent_strg_it->first<<std::endl;
-                std::cerr<<"    diff       : "<<day_diff<<std::endl;
-                std::cerr<<"    max days   : "<<__opt.max_days * 100<<std::endl;
-                std::cerr<<"    Fail to remove the oldest storage: ";
-                std::cerr<<oldest_strg_it->second->name()<<std::endl;
-            }
-            strgs.erase(oldest_strg_it);
+        // pinned clips are kept.
+        auto oldest_strg_it = oldest_unpinned();
+        if(oldest_strg_it == strgs.end())
+        {
+            break;
         }
-        else
+        auto recent_strg_it = std::prev(strgs.end());
+        auto sec_diff = int64_t(recent_strg_it->first) - oldest_strg_it->first;
+        bool over_days = sec_diff >= int64_t(__opt.max_days) * 86400;
+        bool over_bytes = __opt.max_bytes > 0 && __bytes > __opt.max_bytes;
+        if(!over_days && !over_bytes)
         {
             break;
         }
+        remove_storage(oldest_strg_it);
     }
 
     return true;
 }
 
-std::string tape::make_file_name(const std::time_t time) const
+std::map<tape::_StrgKey, std::shared_ptr<storage>>::iterator
+tape::remove_storage(std::map<_StrgKey, std::shared_ptr<storage>>::iterator it)
 {
-    std::filesystem::path p = _root;
-    std::stringstream ss;
-//    auto t = *gmtime(&time);
-    std::tm t;
-    auto ptr = gmtime_r(&time, &t);
-    if(!ptr){
-        std::cerr<<"[VR] tape::make_file_name: gmtime_r(&time, &t)"<<std::endl;
+    auto next = std::next(it);
+    auto span = it->second->span();
+    if(span.second > 0)
+    {
+        // merged timelines also cover gaps up to the neighbour storages.
+        if(it != strgs.begin())
+        {
+            auto prev_end = std::prev(it)->second->span().second;
+            if(prev_end > 0 && prev_end < span.first)
+            {
+                span.first = prev_end + 1;
+            }
+        }
+        if(next != strgs.end())
+        {
+            auto next_first = next->second->span().first;
+            if(next_first > span.second + 1)
+            {
+                span.second = next_first - 1;
+            }
+        }
+        std::unique_lock<std::mutex> lock(__tlmtx);
+        __tl_index.erase(span.first, span.second);
     }
-    ss<<std::setw(4)<<std::setfill('0')<<t.tm_year + SYSTEM_BASE_YEAR<<"-";
-    ss<<std::setw(2)<<std::setfill('0')<<t.tm_mon + 1<<"-";
-    ss<<std::setw(2)<<std::setfill('0')<<t.tm_mday<<"@";
-    ss<<std::setw(2)<<std::setfill('0')<<t.tm_hour<<"-";
-    ss<<std::setw(2)<<std::setfill('0')<<t.tm_min<<"-";
-    ss<<std::setw(2)<<std::setfill('0')<<t.tm_sec;
-    return (p / ss.str()).string();
+    auto bytes = std::min<uint64_t>(it->second->bytes(), __bytes);
+    dispose(it->second);
+    __bytes -= bytes;
+    // clips of the storage take its place.
+    auto first = __pins.lower_bound(it->first);
+    auto last = next == strgs.end() ? __pins.end() : __pins.lower_bound(next->first);
+    strgs.erase(it);
+    for(auto pin = first; pin != last; pin = __pins.erase(pin))
+    {
+        {
+            std::unique_lock<std::mutex> lock(__tlmtx);
+            index_timeline(pin->second);
+        }
+        __bytes += pin->second->bytes();
+        strgs.insert(next, *pin);
+    }
+    return next;
 }
 
-std::vector<std::string> tape::get_old_files(const std::string dir, const int day)
+void tape::prepare_next()
 {
-    auto strg_list = utility::get_matched_file_list(dir, FILE_NAME_REGEX);
-    std::vector<std::string> old_list;
-    for(auto& it : strg_list)
+    auto now = system_clock::to_time_t(system_clock::now());
+    auto next_time = segment_slot(now) + std::time_t(__opt.segment_minutes) * 60;
+    auto next_key = make_storage_key(next_time);
+    int64_t estimate = 0;
+    std::shared_ptr<storage> stale;
     {
-        std::tm t;
-        strptime(it.first.c_str(), "%Y-%m-%d@%H-%M-%S", &t);
-        auto diff = std::time(nullptr) - timegm(&t);
-//        t = *gmtime(&diff);
-        auto ptr = gmtime_r(&diff, &t);
-        if(!ptr){
-            std::cerr<<"[VR] tape::get_old_files: gmtime_r(&time, &t)"<<std::endl;
+        std::unique_lock<std::mutex> lock(__smtx);
+        if(__next && __next_key == next_key)
+        {
+            return;
         }
-        int passed_hours = t.tm_yday * 24 + t.tm_hour;
-        if(day * 24 - passed_hours <= 0)
+        // the write worker already started the slot.
+        auto started = strgs.lower_bound(next_key);
+        if(started != strgs.end() &&
+            segment_slot(std::time_t(started->first) + __base_time) == next_time)
         {
-            for(auto& f : it.second)
-            {
-                std::filesystem::path fullpath = dir;
-                old_list.push_back(fullpath / f);
-            }
+            return;
+        }
+        stale = std::move(__next);
+        __next = nullptr;
+        // the next segment may be as large as the recent complete ones.
+        auto it = strgs.rbegin();
+        for(int n = 0; n < 2 && it != strgs.rend(); ++n, ++it)
+        {
+            estimate = std::max<int64_t>(estimate, it->second->bytes());
         }
     }
-    return old_list;
+    if(stale)
+    {
+        // its slot passed without any gop.
+        dispose(stale);
+    }
+    if(__opt.max_segment_bytes > 0)
+    {
+        estimate = std::min<int64_t>(estimate, __opt.max_segment_bytes);
+    }
+    auto strg = std::make_shared<storage>(make_file_name(next_time, storage_dir()));
+    if(!strg->prepare(estimate))
+    {
+        std::cerr<<"[VR] tape::prepare_next: fail to prepare "<<strg->name()<<std::endl;
+        dispose(strg);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(__smtx);
+    __next = strg;
+    __next_key = next_key;
 }
 
-void tape::restrict_option()
+std::shared_ptr<storage> tape::take_prepared(const std::time_t time)
 {
-    // set minimum max_days.
-    if(__opt.max_days < 1)
+    std::unique_lock<std::mutex> lock(__smtx);
+    if(!__next || __next_key > make_storage_key(time) ||
+        segment_slot(std::time_t(__next_key) + __base_time) != segment_slot(time) ||
+        strgs.count(__next_key))
     {
-        __opt.max_days = 1;
+        return nullptr;
     }
+    auto strg = std::move(__next);
+    __next = nullptr;
+    strgs[__next_key] = strg;
+    __bytes += strg->bytes();
+    return strg;
 }
 
-storage::frame_info tape::iterator::operator*()
+void tape::seal_pending()
+{
+    std::vector<std::shared_ptr<storage>> pending;
+    {
+        std::unique_lock<std::mutex> lock(__bgmtx);
+        pending.swap(__unsealed);
+    }
+    for(auto& strg : pending)
+    {
+        auto before = strg->bytes();
+        if(!strg->seal())
+        {
+            std::cerr<<"[VR] fail to seal "<<strg->name()<<std::endl;
+        }
+        __bytes += strg->bytes() - before;
+    }
+}
+
+void tape::dispose(const std::shared_ptr<storage>& strg)
+{
+    auto files = strg->files();
+    strg->close();
+    __deleter->remove(files);
+}
+
+void tape::migrate()
+{
+    std::vector<tier> tiers;
+    {
+        std::unique_lock<std::mutex> lock(__wmtx);
+        tiers = __opt.tiers;
+    }
+    if(tiers.empty())
+    {
+        return;
+    }
+    std::vector<std::pair<_StrgKey, std::shared_ptr<storage>>> cands;
+    {
+        std::unique_lock<std::mutex> lock(__smtx);
+        std::unique_lock<std::mutex> tl_lock(__tlmtx);
+        for(auto& it : strgs)
+        {
+            if(it.second != __live && !is_pinned(it.second))
+            {
+                cands.push_back(it);
+            }
+        }
+    }
+    auto now = duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch()).count();
+    for(auto& cand : cands)
+    {
+        {
+            std::unique_lock<std::mutex> lock(__bgmtx);
+            if(__bg_stop)
+            {
+                break;
+            }
+        }
+        auto age = now - int64_t(cand.second->span().second);
+        // the coldest tier the storage is old enough for.
+        int target = -1;
+        int current = -1;
+        auto cur_dir = std::filesystem::path(cand.second->name()).parent_path();
+        for(size_t n = 0; n < tiers.size(); ++n)
+        {
+            if(age >= int64_t(tiers[n].min_age_hours) * 3600000)
+            {
+                target = int(n);
+            }
+            if(std::filesystem::path(tiers[n].dir) == cur_dir)
+            {
+                current = int(n);
+            }
+        }
+        if(target <= current)
+        {
+            continue;
+        }
+        if(!move_storage(cand.first, cand.second, tiers[target].dir))
+        {
+            std::cerr<<"[VR] tape::migrate: fail to move "<<cand.second->name();
+            std::cerr<<" to "<<tiers[target].dir<<std::endl;
+        }
+    }
+}
+
+bool tape::move_storage(_StrgKey key,
+    std::shared_ptr<storage> strg, const std::string dir)
+{
+    namespace fs = std::filesystem;
+    auto dst_name = (fs::path(dir) / fs::path(strg->name()).filename()).string();
+    std::vector<std::pair<std::string, std::string>> copied;
+    std::error_code ec;
+    if(!utility::create_directories(dir, ec))
+    {
+        return false;
+    }
+    for(auto& f : strg->files())
+    {
+        // sequential copy in kernel, then rename to keep it consistent.
+        auto dst = dst_name + f.substr(strg->name().size());
+        fs::copy_file(f, dst + ".tmp", fs::copy_options::overwrite_existing, ec);
+        if(ec.value())
+        {
+            break;
+        }
+        copied.push_back(std::make_pair(dst + ".tmp", dst));
+    }
+    for(auto& it : copied)
+    {
+        if(ec.value())
+        {
+            break;
+        }
+        fs::rename(it.first, it.second, ec);
+    }
+    if(ec.value())
+    {
+        for(auto& it : copied)
+        {
+            fs::remove(it.first, ec);
+            fs::remove(it.second, ec);
+        }
+        return false;
+    }
+
+    auto moved = std::make_shared<storage>(dst_name);
+    {
+        std::unique_lock<std::mutex> lock(__smtx);
+        auto it = strgs.find(key);
+        if(it != strgs.end() && it->second == strg)
+        {
+            it->second = moved;
+            __retired.push_back(strg);
+            return true;
+        }
+    }
+    // removed while copying.
+    dispose(moved);
+    return true;
+}
+
+void tape::thin()
+{
+    int days;
+    {
+        std::unique_lock<std::mutex> lock(__wmtx);
+        days = __opt.thin_after_days;
+    }
+    if(days <= 0)
+    {
+        return;
+    }
+    auto now = duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch()).count();
+    std::vector<std::pair<_StrgKey, std::shared_ptr<storage>>> cands;
+    {
+        std::unique_lock<std::mutex> lock(__smtx);
+        std::unique_lock<std::mutex> tl_lock(__tlmtx);
+        for(auto& it : strgs)
+        {
+            if(it.second == __live || it.second->thinned() || is_pinned(it.second))
+            {
+                continue;
+            }
+            if(now - int64_t(it.second->span().second) >= int64_t(days) * 86400000)
+            {
+                cands.push_back(it);
+            }
+        }
+    }
+    for(auto& cand : cands)
+    {
+        {
+            std::unique_lock<std::mutex> lock(__bgmtx);
+            if(__bg_stop)
+            {
+                break;
+            }
+        }
+        if(!thin_storage(cand.first, cand.second))
+        {
+            std::cerr<<"[VR] tape::thin: fail to thin "<<cand.second->name()<<std::endl;
+        }
+    }
+}
+
+bool tape::thin_storage(_StrgKey key, const std::shared_ptr<storage>& strg)
+{
+    namespace fs = std::filesystem;
+    auto name = strg->name();
+    auto tmp_name = name + ".thin";
+    std::error_code ec;
+    auto remove_tmp = [&](){
+        for(auto& ext : FILE_EXTENSIONS)
+        {
+            fs::remove(tmp_name + "." + ext, ec);
+        }
+    };
+    if(!strg->thin(tmp_name))
+    {
+        remove_tmp();
+        return false;
+    }
+    std::vector<std::string> olds;
+    {
+        std::unique_lock<std::mutex> lock(__smtx);
+        auto it = strgs.find(key);
+        // files are replaced under the same name,
+        // so wait until no iterator reads the storage,
+        // strgs and the candidate list hold it.
+        // locations found in the old files carry their inode,
+        // readers by path(e.g. gop_cache) reject them in the new ones.
+        if(it == strgs.end() || it->second != strg || strg.use_count() > 2)
+        {
+            remove_tmp();
+            // removed, moved, or still read. try again on the next run.
+            return it == strgs.end() || it->second != strg;
+        }
+        auto before = strg->bytes();
+        for(auto& f : strg->files())
+        {
+            fs::rename(f, f + ".old", ec);
+            if(ec.value())
+            {
+                break;
+            }
+            olds.push_back(f + ".old");
+        }
+        for(auto& ext : FILE_EXTENSIONS)
+        {
+            if(ec.value())
+            {
+                break;
+            }
+            if(fs::exists(tmp_name + "." + ext))
+            {
+                fs::rename(tmp_name + "." + ext, name + "." + ext, ec);
+            }
+        }
+        if(ec.value())
+        {
+            // put the original files back.
+            for(auto& old : olds)
+            {
+                std::error_code rec;
+                fs::rename(old, old.substr(0, old.size() - 4), rec);
+            }
+            remove_tmp();
+            return false;
+        }
+        it->second = std::make_shared<storage>(name);
+        __bytes += it->second->bytes();
+        __bytes -= before;
+    }
+    __deleter->remove(olds);
+    return true;
+}
+
+bool tape::pin(uint64_t from, uint64_t to)
+{
+    namespace fs = std::filesystem;
+    auto pin_dir = (fs::path(_root) / PIN_DIR).string();
+    std::vector<std::pair<_StrgKey, std::shared_ptr<storage>>> srcs;
+    {
+        std::unique_lock<std::mutex> lock(__smtx);
+        for(auto& it : strgs)
+        {
+            auto span = it.second->span();
+            if(!is_pinned(it.second) && span.second >= from && span.first <= to)
+            {
+                srcs.push_back(it);
+            }
+        }
+    }
+    bool status = true;
+    for(auto& src : srcs)
+    {
+        // merge clips of the storage overlapping the range.
+        uint64_t clip_from = from;
+        uint64_t clip_to = to;
+        std::vector<std::shared_ptr<storage>> merged;
+        {
+            std::unique_lock<std::mutex> lock(__smtx);
+            auto next = strgs.upper_bound(src.first);
+            auto last = next == strgs.end() ? __pins.end() : __pins.lower_bound(next->first);
+            for(auto it = __pins.lower_bound(src.first); it != last; ++it)
+            {
+                auto span = it->second->span();
+                if(span.second >= clip_from && span.first <= clip_to)
+                {
+                    clip_from = std::min(clip_from, span.first);
+                    clip_to = std::max(clip_to, span.second);
+                    merged.push_back(it->second);
+                }
+            }
+        }
+        auto gops = src.second->search(storage::event_query(), clip_from, clip_to);
+        if(gops.empty())
+        {
+            continue;
+        }
+        auto clip_time = std::time_t(gops.front().ts / 1000);
+        auto name = make_file_name(clip_time, pin_dir);
+        if(!src.second->clip(name, clip_from, clip_to))
+        {
+            std::cerr<<"[VR] tape::pin: fail to clip "<<src.second->name()<<std::endl;
+            status = false;
+            continue;
+        }
+        auto clip = std::make_shared<storage>(name);
+        std::unique_lock<std::mutex> lock(__smtx);
+        for(auto& old : merged)
+        {
+            for(auto it = __pins.begin(); it != __pins.end(); ++it)
+            {
+                if(it->second == old)
+                {
+                    __pins.erase(it);
+                    break;
+                }
+            }
+            // a clip of the same name was overwritten.
+            if(old->name() != name)
+            {
+                dispose(old);
+            }
+        }
+        auto strg_it = strgs.find(src.first);
+        if(strg_it != strgs.end() && strg_it->second == src.second)
+        {
+            __pins[make_storage_key(clip_time)] = clip;
+        }
+        else if(!strgs.count(make_storage_key(clip_time)))
+        {
+            // the storage was removed while clipping.
+            strgs[make_storage_key(clip_time)] = clip;
+            __bytes += clip->bytes();
+            std::unique_lock<std::mutex> tl_lock(__tlmtx);
+            index_timeline(clip);
+        }
+    }
+    return status;
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> tape::pins()
+{
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    std::unique_lock<std::mutex> lock(__smtx);
+    for(auto& it : __pins)
+    {
+        ranges.push_back(it.second->span());
+    }
+    for(auto& it : strgs)
+    {
+        if(is_pinned(it.second))
+        {
+            ranges.push_back(it.second->span());
+        }
+    }
+    std::sort(ranges.begin(), ranges.end());
+    return ranges;
+}
+
+void tape::trim_pins()
+{
+    std::vector<std::shared_ptr<storage>> clips;
+    {
+        std::unique_lock<std::mutex> lock(__smtx);
+        for(auto& it : strgs)
+        {
+            if(is_pinned(it.second))
+            {
+                clips.push_back(it.second);
+            }
+        }
+    }
+    // clips linked to removed storages hold their whole data.
+    for(auto& clip : clips)
+    {
+        clip->trim();
+    }
+}
+
+bool tape::is_pinned(const std::shared_ptr<storage>& strg) const
+{
+    return std::filesystem::path(strg->name()).parent_path() ==
+        std::filesystem::path(_root) / PIN_DIR;
+}
+
+std::map<tape::_StrgKey, std::shared_ptr<storage>>::iterator tape::oldest_unpinned(
+    const std::string& root)
+{
+    std::unique_lock<std::mutex> tl_lock(__tlmtx);
+    for(auto it = strgs.begin(); it != strgs.end(); ++it)
+    {
+        if(it->second == __live)
+        {
+            break;
+        }
+        if(!root.empty() && !utility::is_under(it->second->name(), root))
+        {
+            continue;
+        }
+        if(!is_pinned(it->second))
+        {
+            return it;
+        }
+    }
+    return strgs.end();
+}
+
+void tape::load_pins()
+{
+    namespace fs = std::filesystem;
+    auto pin_dir = (fs::path(_root) / PIN_DIR).string();
+    for(auto& it : __catalogs[pin_dir]->list())
+    {
+        std::tm t;
+        strptime(it.first.c_str(), "%Y-%m-%d@%H-%M-%S", &t);
+        auto key = make_storage_key(timegm(&t));
+        auto clip = std::make_shared<storage>((fs::path(pin_dir) / it.first).string());
+        if(clip->empty())
+        {
+            continue;
+        }
+        // the storage the clip was made from.
+        auto src = strgs.upper_bound(key);
+        if(src != strgs.begin() && std::prev(src)->second->span().second >= clip->span().first)
+        {
+            __pins[key] = clip;
+        }
+        else if(!strgs.count(key))
+        {
+            strgs[key] = clip;
+            __bytes += clip->bytes();
+            std::unique_lock<std::mutex> lock(__tlmtx);
+            index_timeline(clip);
+        }
+    }
+}
+
+void tape::release_retired()
+{
+    std::unique_lock<std::mutex> lock(__smtx);
+    for(auto it = __retired.begin(); it != __retired.end();)
+    {
+        if(it->use_count() == 1)
+        {
+            dispose(*it);
+            it = __retired.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void tape::index_timeline(const std::shared_ptr<storage>& strg)
+{
+    for(int index = 0; index < storage::__max_events+1; ++index)
+    {
+        for(auto& tl : strg->timeline(index))
+        {
+            __tl_index.insert(index, tl);
+        }
+    }
+}
+
+void tape::index_gop(const std::vector<storage::frame_info>& gop)
+{
+    // same spans as storage::update_timeline.
+    constexpr uint64_t event_tail = 3500; // ms
+    uint64_t at = gop.front().msec.count();
+    uint64_t end = gop.back().msec.count();
+    uint8_t events = 0;
+    for(auto& frame : gop)
+    {
+        events |= frame.events;
+    }
+    {
+        std::unique_lock<std::mutex> lock(__tlmtx);
+        __tl_index.insert(0, std::make_pair(at, end));
+        for(int index = 1; index < storage::__max_events+1; ++index)
+        {
+            if(events & (1 << (index-1)))
+            {
+                __tl_index.insert(index, std::make_pair(at, at + event_tail));
+            }
+        }
+    }
+    __last_written.store(end, std::memory_order_relaxed);
+}
+
+std::string tape::make_file_name(const std::time_t time) const
+{
+    return make_file_name(time, _root);
+}
+
+std::string tape::make_file_name(
+    const std::time_t time, const std::string dir) const
+{
+    std::filesystem::path p = dir;
+    std::stringstream ss;
+//    auto t = *gmtime(&time);
+    std::tm t;
+    auto ptr = gmtime_r(&time, &t);
+    if(!ptr){
+        std::cerr<<"[VR] tape::make_file_name: gmtime_r(&time, &t)"<<std::endl;
+    }
+    ss<<std::setw(4)<<std::setfill('0')<<t.tm_year + SYSTEM_BASE_YEAR<<"-";
+    ss<<std::setw(2)<<std::setfill('0')<<t.tm_mon + 1<<"-";
+    ss<<std::setw(2)<<std::setfill('0')<<t.tm_mday<<"@";
+    ss<<std::setw(2)<<std::setfill('0')<<t.tm_hour<<"-";
+    ss<<std::setw(2)<<std::setfill('0')<<t.tm_min<<"-";
+    ss<<std::setw(2)<<std::setfill('0')<<t.tm_sec;
+    return (p / ss.str()).string();
+}
+
+std::vector<std::string> tape::get_old_files(const std::string dir, const int day)
+{
+    auto strg_list = __catalogs[dir]->list();
+    std::vector<std::string> old_list;
+    for(auto& it : strg_list)
+    {
+        std::tm t;
+        strptime(it.first.c_str(), "%Y-%m-%d@%H-%M-%S", &t);
+        auto diff = std::time(nullptr) - timegm(&t);
+//        t = *gmtime(&diff);
+        auto ptr = gmtime_r(&diff, &t);
+        if(!ptr){
+            std::cerr<<"[VR] tape::get_old_files: gmtime_r(&time, &t)"<<std::endl;
+        }
+        int passed_hours = t.tm_yday * 24 + t.tm_hour;
+        if(day * 24 - passed_hours <= 0)
+        {
+            for(auto& f : it.second)
+            {
+                std::filesystem::path fullpath = dir;
+                old_list.push_back(fullpath / f);
+            }
+        }
+    }
+    return old_list;
+}
+
+void tape::restrict_option()
+{
+    // set minimum max_days.
+    if(__opt.max_days < 1)
+    {
+        __opt.max_days = 1;
+    }
+    // a segment from 5 minutes to a day.
+    __opt.segment_minutes = std::min(std::max(__opt.segment_minutes, 5), 1440);
+    if(__opt.weight <= 0)
+    {
+        __opt.weight = 1.0;
+    }
+    // tiers in ascending order of age.
+    auto& tiers = __opt.tiers;
+    tiers.erase(std::remove_if(tiers.begin(), tiers.end(),
+        [this](const tier& t){ return t.dir.empty() || t.dir == _root; }),
+        tiers.end());
+    std::stable_sort(tiers.begin(), tiers.end(),
+        [](const tier& a, const tier& b){
+            return a.min_age_hours < b.min_age_hours;
+        });
+}
+
+storage::frame_info tape::iterator::operator*()
 {
     if(!__buf.empty())
     {
@@ -408,22 +1379,27 @@ tape::iterator& tape::iterator::operator++()
     {
         __buf.pop();
     }
+    if(!__strg)
+    {
+        return *this;
+    }
     if(__idx_iter == __strg->end())
     {
-        __iter = std::next(__iter);
-        if(__iter != __iter_end)
+        std::shared_ptr<storage> next;
         {
-            __strg = __iter->second;
-            __idx_iter = __strg->begin();
+            std::unique_lock<std::mutex> lock(__tp->__smtx);
+            auto it = __tp->strgs.upper_bound(__key);
+            if(it != __tp->strgs.end())
+            {
+                __key = it->first;
+                next = it->second;
+            }
         }
-        else
+        // nullptr is the end, after the latest storage.
+        __strg = next;
+        if(__strg)
         {
-            // __iter is the end of iterator in hear.
-            // try get previous iterator.
-            // and get std::next again later.
-            // the latest index with the latest storage.
-            __iter = __iter_end;
-            __idx_iter = std::prev(__iter)->second->end();
+            __idx_iter = __strg->begin();
         }
     }
     else{
@@ -442,53 +1418,125 @@ tape::iterator& tape::iterator::operator++()
 
 bool tape::iterator::operator==(const this_type& it) const
 {
-    return __iter == it.__iter;
+    if(!__strg || !it.__strg)
+    {
+        return __strg == it.__strg;
+    }
+    return __tp == it.__tp && __key == it.__key;
 }
 
 bool tape::iterator::operator!=(const this_type& it) const
 {
-    return __iter != it.__iter;
+    return !(*this == it);
 }
 
-tape_pool::tape_pool(std::string root_dir, tape_pool::opt_calback_fn fn)
+tape_pool::tape_pool(std::string root_dir, tape_pool::opt_calback_fn fn, uint64_t max_bytes)
+    : tape_pool(std::vector<std::string>{root_dir}, fn, max_bytes)
+{}
+
+tape_pool::tape_pool(std::vector<std::string> root_dirs, tape_pool::opt_calback_fn fn, uint64_t max_bytes)
+    : __max_bytes(max_bytes), __stop(false)
 {
-    std::error_code ec;
-    std::filesystem::create_directories(
-        std::filesystem::path(root_dir), ec);
-    if(ec.value()) {
-        std::cout << "failed to create root directory" << std::endl;
-        exit(-1);
+    for(auto& root_dir : root_dirs)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(
+            std::filesystem::path(root_dir), ec);
+        if(ec.value()) {
+            std::cout << "failed to create root directory" << std::endl;
+            exit(-1);
+        }
     }
     using namespace std::filesystem;
-    __root_dir = root_dir;
-    for(auto& p: directory_iterator(root_dir))
+    __root_dirs = root_dirs;
+    __volumes = std::make_shared<volume_set>(root_dirs);
+    __deleter = std::make_shared<utility::file_deleter>();
+    // a tape may have folders on several volumes, open it once.
+    std::map<std::string, std::string> tape_dirs;
+    for(auto& root_dir : root_dirs)
     {
-        if(p.is_directory())
+        for(auto& p: directory_iterator(root_dir))
         {
-            auto tape_key = p.path().filename().string();
-            std::cout<<tape_key<<std::endl;
-            auto tp = std::make_shared<vr::tape>();
-            tp->open(p.path().string(), fn(tape_key));
-            __tps[tape_key] = tp;
+            if(p.is_directory())
+            {
+                tape_dirs.emplace(p.path().filename().string(), p.path().string());
+            }
         }
     }
+    for(auto& it : tape_dirs)
+    {
+        auto tape_key = it.first;
+        std::cout<<tape_key<<std::endl;
+        auto tp = std::make_shared<vr::tape>();
+        tp->set_deleter(__deleter);
+        tp->set_volumes(__volumes);
+        tp->open(it.second, fn(tape_key));
+        __tps[tape_key] = tp;
+    }
+    __reaper = std::thread(
+        [this]()
+        {
+            while(true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(__pmtx);
+                    __rcv.wait_for(lock, std::chrono::seconds(REAP_INTERVAL_SEC),
+                        [this](){return __stop;});
+                    if(__stop)
+                    {
+                        break;
+                    }
+                }
+                reap();
+            }
+        }
+    );
+}
+
+void tape_pool::set_quota(uint64_t max_bytes)
+{
+    {
+        std::unique_lock<std::mutex> lock(__pmtx);
+        __max_bytes = max_bytes;
+    }
+    __rcv.notify_one();
+}
+
+uint64_t tape_pool::bytes()
+{
+    std::unique_lock<std::mutex> lock(__pmtx);
+    uint64_t total = 0;
+    for(auto& it : __tps)
+    {
+        total += it.second->bytes();
+    }
+    return total;
 }
 
 std::shared_ptr<vr::tape> tape_pool::create(std::string tp_key, vr::tape::option opt)
 {
     auto tp = std::make_shared<vr::tape>();
-    std::string name = __root_dir + "/" + tp_key;
+    tp->set_deleter(__deleter);
+    tp->set_volumes(__volumes);
+    std::string name = __volumes->pick() + "/" + tp_key;
     if(!tp->open(name, opt))
     {
         tp->close();
         return nullptr;
     }
+    std::unique_lock<std::mutex> lock(__pmtx);
     __tps[tp_key] = tp;
     return tp;
 }
 
+std::vector<volume_set::stats> tape_pool::volume_stats()
+{
+    return __volumes->get_stats();
+}
+
 std::shared_ptr<vr::tape> tape_pool::find(std::string tp_key)
 {
+    std::unique_lock<std::mutex> lock(__pmtx);
     auto it = __tps.find(tp_key);
     if(it == __tps.end()){
         return nullptr;
@@ -496,6 +1544,22 @@ std::shared_ptr<vr::tape> tape_pool::find(std::string tp_key)
     return it->second;
 }
 
+std::map<std::string, std::vector<storage::gop_location>> tape_pool::search(
+    const storage::event_query& query, uint64_t from, uint64_t to)
+{
+    std::map<std::string, std::vector<storage::gop_location>> found;
+    std::unique_lock<std::mutex> lock(__pmtx);
+    for(auto& it : __tps)
+    {
+        auto gops = it.second->search(query, from, to);
+        if(!gops.empty())
+        {
+            found[it.first] = std::move(gops);
+        }
+    }
+    return found;
+}
+
 tape_pool::~tape_pool()
 {
     close();
@@ -503,9 +1567,207 @@ tape_pool::~tape_pool()
 
 void tape_pool::close()
 {
+    {
+        std::unique_lock<std::mutex> lock(__pmtx);
+        __stop = true;
+    }
+    __rcv.notify_one();
+    if(__reaper.joinable())
+    {
+        __reaper.join();
+    }
     for(auto& it : __tps){
         it.second->close();
     }
+    __deleter->close();
+}
+
+void tape_pool::reap()
+{
+    std::vector<std::shared_ptr<vr::tape>> tps;
+    uint64_t max_bytes;
+    {
+        std::unique_lock<std::mutex> lock(__pmtx);
+        for(auto& it : __tps)
+        {
+            tps.push_back(it.second);
+        }
+        max_bytes = __max_bytes;
+    }
+    // quota of each tape.
+    uint64_t total = 0;
+    for(auto& tp : tps)
+    {
+        auto opt = tp->get_option();
+        while(opt.max_bytes > 0 && tp->bytes() > opt.max_bytes)
+        {
+            if(!tp->remove_oldest())
+            {
+                break;
+            }
+        }
+        total += tp->bytes();
+    }
+    // quota of the pool, evict the oldest storage among all tapes.
+    // age of a storage is divided by weight of its tape.
+    while(max_bytes > 0 && total > max_bytes)
+    {
+        auto now = duration_cast<milliseconds>(
+            system_clock::now().time_since_epoch()).count();
+        std::shared_ptr<vr::tape> victim;
+        double victim_age = -1;
+        for(auto& tp : tps)
+        {
+            auto oldest = tp->oldest_time();
+            if(oldest < 0)
+            {
+                continue;
+            }
+            double age = double(now - oldest) / tp->get_option().weight;
+            if(age > victim_age)
+            {
+                victim = tp;
+                victim_age = age;
+            }
+        }
+        if(!victim)
+        {
+            break;
+        }
+        if(!victim->remove_oldest())
+        {
+            break;
+        }
+        total = 0;
+        for(auto& tp : tps)
+        {
+            total += tp->bytes();
+        }
+    }
+    watch(tps);
+}
+
+void tape_pool::watch(const std::vector<std::shared_ptr<vr::tape>>& tps)
+{
+    auto now = steady_clock::now();
+    uint64_t written = 0;
+    for(auto& tp : tps)
+    {
+        written += tp->written();
+    }
+    watchdog_option opt;
+    double rate;
+    {
+        std::unique_lock<std::mutex> lock(__pmtx);
+        opt = __wd_opt;
+        double elapsed = duration<double>(now - __wd_checked).count();
+        if(__wd_checked.time_since_epoch().count() == 0 || elapsed <= 0 || written < __wd_written)
+        {
+            // no baseline yet.
+            __wd_written = written;
+            __wd_checked = now;
+            return;
+        }
+        // smooth the rate over a few intervals.
+        double current = double(written - __wd_written) / elapsed;
+        rate = __wd_stats.write_rate > 0 ? __wd_stats.write_rate * 0.7 + current * 0.3 : current;
+        __wd_written = written;
+        __wd_checked = now;
+    }
+
+    auto predict = [&rate](int64_t usable) -> double {
+        if(rate <= 0)
+        {
+            return -1;
+        }
+        return usable <= 0 ? 0 : double(usable) / rate;
+    };
+
+    // each volume frees space from its own storages only.
+    // all writes may go to any volume, so each is judged by the whole rate.
+    std::string fullest;
+    int64_t lowest = INT64_MAX;
+    uint64_t evicted_storages = 0;
+    uint64_t evicted_bytes = 0;
+    for(auto& vol : __volumes->get_stats())
+    {
+        auto reserve = static_cast<int64_t>(vol.total_bytes * opt.min_free_ratio);
+        // bytes queued for deletion on the volume will be free soon.
+        auto usable = static_cast<int64_t>(vol.free_bytes) - reserve +
+            static_cast<int64_t>(__deleter->pending_bytes(vol.root));
+        uint64_t storages = 0;
+        uint64_t bytes = 0;
+        while(usable <= 0 || (rate > 0 && predict(usable) < opt.horizon.count()))
+        {
+            std::shared_ptr<vr::tape> victim;
+            int64_t victim_time = INT64_MAX;
+            for(auto& tp : tps)
+            {
+                auto oldest = tp->oldest_time(vol.root);
+                if(oldest >= 0 && oldest < victim_time)
+                {
+                    victim = tp;
+                    victim_time = oldest;
+                }
+            }
+            if(!victim)
+            {
+                break;
+            }
+            auto before = victim->bytes();
+            if(!victim->remove_oldest(vol.root))
+            {
+                break;
+            }
+            auto freed = before - std::min(before, victim->bytes());
+            usable += freed;
+            bytes += freed;
+            ++storages;
+        }
+        if(storages > 0)
+        {
+            std::cerr<<"[VR] tape_pool::watch: "<<vol.root<<" is filling up, evicted ";
+            std::cerr<<storages<<" storages of "<<bytes<<" bytes"<<std::endl;
+        }
+        evicted_storages += storages;
+        evicted_bytes += bytes;
+        if(usable < lowest)
+        {
+            lowest = usable;
+            fullest = vol.root;
+        }
+    }
+    if(fullest.empty())
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(__pmtx);
+    __wd_stats.write_rate = rate;
+    __wd_stats.volume = fullest;
+    __wd_stats.time_to_full = predict(lowest);
+    if(evicted_storages > 0)
+    {
+        __wd_stats.evicted_storages += evicted_storages;
+        __wd_stats.evicted_bytes += evicted_bytes;
+        __wd_stats.last_eviction = duration_cast<milliseconds>(
+            system_clock::now().time_since_epoch()).count();
+    }
+}
+
+void tape_pool::set_watchdog(watchdog_option opt)
+{
+    {
+        std::unique_lock<std::mutex> lock(__pmtx);
+        __wd_opt = opt;
+    }
+    __rcv.notify_one();
+}
+
+tape_pool::watchdog_stats tape_pool::get_watchdog_stats()
+{
+    std::unique_lock<std::mutex> lock(__pmtx);
+    return __wd_stats;
 }
 
 } // end namespace vr
@@ -1,5 +1,9 @@
 #pragma once
 #include "vr/recorder/storage.h"
+#include "vr/recorder/timeline_index.h"
+#include "vr/recorder/volume.h"
+#include "vr/utility/catalog.h"
+#include "vr/utility/deleter.h"
 #include <string>
 #include <map>
 #include <memory>
@@ -8,6 +12,7 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include <functional>
 
 namespace vr
@@ -22,6 +27,18 @@ public:
     static constexpr int SYSTEM_BASE_YEAR = 1900;
     static constexpr int BASE_YEAR = 2020;
     static const std::string FILE_NAME_REGEX;
+    // extensions of storage files, see FILE_NAME_REGEX.
+    static const std::vector<std::string> FILE_EXTENSIONS;
+    // sub folder of pinned clips in the folder given to open.
+    static const std::string PIN_DIR;
+
+    struct tier
+    {
+        // folder path of the tape in this tier.
+        std::string dir;
+        // storages older than this move to this tier.
+        int min_age_hours;
+    };
 
     struct option
     {
@@ -29,6 +46,22 @@ public:
         int max_days = 90;
         // remove all previous storages.
         bool remove_previous = false;
+        // keep storages upto max_bytes, 0 is unlimited.
+        uint64_t max_bytes = 0;
+        // a new storage starts every segment_minutes(5~1440).
+        int segment_minutes = 60;
+        // a new storage also starts if the storage reaches this size,
+        // 0 is unlimited.
+        uint64_t max_segment_bytes = 0;
+        // tape_pool evicts storages of larger weight later
+        // to keep its quota.
+        double weight = 1.0;
+        // keep only key frames of gops without events in storages
+        // older than thin_after_days, 0 keeps all frames.
+        int thin_after_days = 0;
+        // colder tiers after the folder given to open,
+        // e.g. ssd for recent storages and hdd for old storages.
+        std::vector<tier> tiers;
     };
 
     class iterator;
@@ -39,6 +72,14 @@ public:
 
     void close();
 
+    // share a deleter for removing storages, call it before open.
+    // tape creates its own deleter if it is not set.
+    void set_deleter(std::shared_ptr<utility::file_deleter> deleter);
+
+    // place new storages on the volumes, call it before open.
+    // folder of this tape on each volume is named after the folder given to open.
+    void set_volumes(std::shared_ptr<volume_set> volumes);
+
     bool update_option(option opt);
     
     option get_option() const;
@@ -46,53 +87,186 @@ public:
     bool write(std::vector<storage::frame_info> gop);
 
     // get all recording timelines.
-    std::vector<std::pair<uint64_t, uint64_t>> timeline(int index);
+    std::vector<std::pair<uint64_t, uint64_t>> timeline(int index = 0);
+
+    // get recording timelines in [from, to] milliseconds,
+    // spans are clipped to the range.
+    std::vector<std::pair<uint64_t, uint64_t>> timeline(
+        int index, uint64_t from, uint64_t to);
+
+    // number of recording timelines in [from, to] milliseconds.
+    size_t count(int index, uint64_t from, uint64_t to);
+
+    // recorded milliseconds in [from, to] milliseconds.
+    uint64_t coverage(int index, uint64_t from, uint64_t to);
 
     // get recent recording timelines.
-    std::shared_ptr<std::pair<uint64_t, uint64_t>> recent_timeline(int index);
+    std::shared_ptr<std::pair<uint64_t, uint64_t>> recent_timeline(int index = 0);
+
+    // true if a gop ended within the given time was written.
+    bool is_recording(milliseconds within = seconds(5)) const;
+
+    // bytes of all storages on disk.
+    uint64_t bytes() const;
+
+    // bytes written since open, for measuring write rates.
+    uint64_t written() const;
+
+    // start time(ms) of the oldest storage except the one being written,
+    // of storages under the root folder if given(e.g. of a volume),
+    // -1 if there is no such storage.
+    int64_t oldest_time(const std::string& root = std::string());
+
+    // remove the oldest storage except the one being written,
+    // of storages under the root folder if given.
+    bool remove_oldest(const std::string& root = std::string());
+
+    // gops between from and to(ms) matching the event query.
+    std::vector<storage::gop_location> search(
+        const storage::event_query& query, uint64_t from, uint64_t to);
+
+    // keep gops between from and to(ms) regardless of retention.
+    // clips of the range share disk blocks with their storages if possible,
+    // and take their place when the storages are removed.
+    // gops written after pinning are not pinned.
+    bool pin(uint64_t from, uint64_t to);
+
+    // time ranges(ms) of pinned clips.
+    std::vector<std::pair<uint64_t, uint64_t>> pins();
 
     iterator find(std::time_t at);
 
     iterator end();
 
 private:
-    bool aggregate_index(const std::string dir);
+    bool aggregate_index(const std::vector<std::string> dirs);
 
     std::vector<std::pair<uint64_t, uint64_t>> merge_timeline(
         const std::vector<std::pair<uint64_t, uint64_t>>& tls);
 
+    // storage to write a gop at the time,
+    // nullptr if the gop belongs to a new segment.
     std::shared_ptr<storage> find_storage(const std::time_t time);
 
+    // start time of the segment slot which has the time.
+    std::time_t segment_slot(const std::time_t time) const;
+
+    // folder for a new storage.
+    std::string storage_dir();
+
     std::shared_ptr<storage> create_storage(const std::time_t time);
 
+    std::shared_ptr<storage> create_storage(
+        const std::time_t time, const std::string dir);
+
     bool remove_oldest_storage();
 
+    // prepare files of the next segment slot ahead of time.
+    void prepare_next();
+
+    // add the prepared segment to strgs if the time is in its slot,
+    // nullptr otherwise.
+    std::shared_ptr<storage> take_prepared(const std::time_t time);
+
+    // seal storages the write worker rolled over from.
+    void seal_pending();
+
+    // queue files of the storage to the deleter.
+    void dispose(const std::shared_ptr<storage>& strg);
+
+    // remove the storage, caller must lock __smtx.
+    std::map<_StrgKey, std::shared_ptr<storage>>::iterator remove_storage(
+        std::map<_StrgKey, std::shared_ptr<storage>>::iterator it);
+
+    // add timelines of the storage to __tl_index.
+    void index_timeline(const std::shared_ptr<storage>& strg);
+
+    // add a written gop to __tl_index.
+    void index_gop(const std::vector<storage::frame_info>& gop);
+
     _StrgKey make_storage_key(const std::time_t time) const;
 
     std::string make_file_name(const std::time_t time) const;
 
+    std::string make_file_name(
+        const std::time_t time, const std::string dir) const;
+
     std::vector<std::string> get_old_files(std::string dir, int yday);
 
+    // move aged storages to colder tiers.
+    void migrate();
+
+    // copy the storage to the folder and replace it in strgs.
+    bool move_storage(_StrgKey key,
+        std::shared_ptr<storage> strg, const std::string dir);
+
+    // thin storages older than thin_after_days.
+    void thin();
+
+    // replace the storage with its thinned copy if nobody uses it.
+    bool thin_storage(_StrgKey key, const std::shared_ptr<storage>& strg);
+
+    // dispose retired storages nobody uses anymore.
+    void release_retired();
+
+    // true if the storage is a pinned clip.
+    bool is_pinned(const std::shared_ptr<storage>& strg) const;
+
+    // oldest storage not pinned nor being written, under the root if given,
+    // strgs.end() if none. caller must lock __smtx.
+    std::map<_StrgKey, std::shared_ptr<storage>>::iterator oldest_unpinned(
+        const std::string& root = std::string());
+
+    // read clips in the pin folder, call it after aggregate_index.
+    void load_pins();
+
+    // free blocks of clips outside their gops once their storages are removed.
+    void trim_pins();
+
     void restrict_option();
 
 private:
 
     /*
     * Key of the map is
-        a value concatenated with year-yday-hour.
-    * It has upto 9 position. Year(4), YearDays(3), Hour(2).
-    * Note that 0 year is 2020 year, i.e. 1 year is 2021 year.
-    * See above BASE_YEAR.
-    * Also note that the range of days is 0~365.
+        start time of the storage in seconds since BASE_YEAR,
+        which is the time in its file name.
+    * A storage covers times from its key to the key of the next storage.
     * Value(storage) of the map is storage class.
     * See storage.h.
     */
     std::map<_StrgKey, std::shared_ptr<storage>> strgs;
+    // mutex for adding and removing storages.
+    std::mutex __smtx;
+    // bytes of all storages, see storage::bytes().
+    std::atomic<uint64_t> __bytes{0};
+
+    // storage which the write worker is writing to.
+    std::shared_ptr<storage> __live;
 
     std::map<_TimelineKey, uint32_t> __timelines;
 
+    // merged timelines of all storages, updated on every written gop.
+    timeline_index __tl_index{storage::__max_events+1};
+    // mutex for __tl_index and __live.
+    std::mutex __tlmtx;
+    // end time(ms) of the last written gop.
+    std::atomic<uint64_t> __last_written{0};
+    // bytes written since open.
+    std::atomic<uint64_t> __written{0};
+
     option __opt;
 
+    // storage files in the folder of each tier, keyed by folder path.
+    // scanned once by open, and cleared once storages are loaded.
+    std::map<std::string, std::shared_ptr<utility::catalog>> __catalogs;
+
+    // removes files of storages off the write path.
+    std::shared_ptr<utility::file_deleter> __deleter;
+
+    // volumes for new storages, nullptr to use the folder given to open.
+    std::shared_ptr<volume_set> __volumes;
+
     // folder path of this tape.
     std::string _root;
     // write buffer.
@@ -105,6 +279,36 @@ private:
     std::condition_variable __wcv;
     // termination condition on thread writer.
     bool __stop;
+
+    // thread for background jobs such as migration between tiers.
+    std::thread __bg_worker;
+    std::mutex __bgmtx;
+    std::condition_variable __bgcv;
+    bool __bg_stop;
+    // storages replaced in strgs, still used by iterators.
+    std::vector<std::shared_ptr<storage>> __retired;
+
+    /*
+    * Pinned clips whose storages are still in strgs, keyed like strgs.
+    * A clip moves to strgs when its storage is removed.
+    * guarded by __smtx.
+    */
+    std::map<_StrgKey, std::shared_ptr<storage>> __pins;
+
+    // next segment prepared by __prep_worker, not in strgs yet.
+    // guarded by __smtx.
+    std::shared_ptr<storage> __next;
+    _StrgKey __next_key = 0;
+    // storages to seal off the write path, guarded by __bgmtx.
+    std::vector<std::shared_ptr<storage>> __unsealed;
+    // thread preparing the next segment and sealing the previous one.
+    std::thread __prep_worker;
+
+public:
+    // interval of background jobs.
+    static constexpr int BACKGROUND_INTERVAL_SEC = 30;
+    // interval of preparing the next segment.
+    static constexpr int PREPARE_INTERVAL_SEC = 10;
 };
 
 class tape::iterator
@@ -114,8 +318,11 @@ class tape::iterator
     typedef tape::iterator this_type;
 
     storage::iterator __idx_iter;
-    std::map<_StrgKey, std::shared_ptr<storage>>::iterator __iter;
-    std::map<_StrgKey, std::shared_ptr<storage>>::iterator __iter_end;
+    tape* __tp = nullptr;
+    // key of the storage being read, the next one is looked up under
+    // __smtx, as storages are replaced in strgs(e.g. moved or thinned).
+    _StrgKey __key = 0;
+    // the storage being read, nullptr at the end.
     std::shared_ptr<storage> __strg;
     std::queue<storage::frame_info> __buf;
 
@@ -131,21 +338,95 @@ public:
 
 class tape_pool
 {
-    std::string __root_dir;
+    // root folders of volumes.
+    std::vector<std::string> __root_dirs;
+    std::shared_ptr<volume_set> __volumes;
     std::map<std::string, std::shared_ptr<vr::tape>> __tps;
+    // deleter shared by all tapes.
+    std::shared_ptr<utility::file_deleter> __deleter;
+    // quota of all tapes in bytes, 0 is unlimited.
+    uint64_t __max_bytes;
+    // mutex for __tps and __max_bytes.
+    std::mutex __pmtx;
+    // reaper evicting oldest storages to keep quotas.
+    std::thread __reaper;
+    std::condition_variable __rcv;
+    bool __stop;
 
 public:
     typedef std::function<vr::tape::option(std::string)> opt_calback_fn;
 
-    tape_pool(std::string root_dir, opt_calback_fn fn);
+    // interval of the reaper checking quotas.
+    static constexpr int REAP_INTERVAL_SEC = 5;
+
+    /*
+    * The watchdog predicts when each volume fills up
+    * from the write rate of all tapes,
+    * and evicts the oldest storages before it does.
+    */
+    struct watchdog_option
+    {
+        // ratio of each volume kept free.
+        double min_free_ratio = 0.02;
+        // evict if a volume is predicted to fill within this.
+        std::chrono::seconds horizon{600};
+    };
+
+    struct watchdog_stats
+    {
+        // write rate of all tapes in bytes per second.
+        double write_rate = 0;
+        // volume predicted to fill first.
+        std::string volume;
+        // seconds until the volume fills, negative if nothing is written.
+        double time_to_full = -1;
+        // storages and bytes evicted by the watchdog since open.
+        uint64_t evicted_storages = 0;
+        uint64_t evicted_bytes = 0;
+        // time(ms) of the last eviction, 0 if never.
+        int64_t last_eviction = 0;
+    };
+
+    tape_pool(std::string root_dir, opt_calback_fn fn, uint64_t max_bytes = 0);
+
+    // tapes spread over several volumes.
+    tape_pool(std::vector<std::string> root_dirs, opt_calback_fn fn, uint64_t max_bytes = 0);
+
+    void set_quota(uint64_t max_bytes);
+
+    // bytes of all tapes on disk.
+    uint64_t bytes();
+
+    std::vector<volume_set::stats> volume_stats();
+
+    void set_watchdog(watchdog_option opt);
+
+    watchdog_stats get_watchdog_stats();
 
     std::shared_ptr<vr::tape> create(std::string tp_key, vr::tape::option opt);
 
     std::shared_ptr<vr::tape> find(std::string tp_key);
 
+    // gops matching the event query on every tape, keyed by tape key.
+    std::map<std::string, std::vector<storage::gop_location>> search(
+        const storage::event_query& query, uint64_t from, uint64_t to);
+
     ~tape_pool();
 
     void close();
+
+private:
+    void reap();
+
+    // evict the oldest storages if a volume is about to fill up.
+    void watch(const std::vector<std::shared_ptr<vr::tape>>& tps);
+
+    // guarded by __pmtx.
+    watchdog_option __wd_opt;
+    watchdog_stats __wd_stats;
+    // bytes written by all tapes at the last watch.
+    uint64_t __wd_written = 0;
+    std::chrono::steady_clock::time_point __wd_checked;
 };
 
 
@@ -0,0 +1,166 @@
+#include "vr/recorder/timeline_index.h"
+#include <algorithm>
+
+namespace vr
+{
+
+timeline_index::timeline_index(int num_timelines, uint64_t tolerance)
+    : __tolerance(tolerance), __spans(num_timelines)
+{}
+
+void timeline_index::insert(int index, span s)
+{
+    if(index < 0 || size_t(index) >= __spans.size() || s.first > s.second)
+    {
+        return;
+    }
+    auto& spans = __spans[index];
+    // common case, appending a new gop to the tail.
+    if(spans.empty() || spans.rbegin()->second + __tolerance < s.first)
+    {
+        spans.emplace_hint(spans.end(), s);
+        return;
+    }
+    // merge every span within the tolerance of s.
+    // in order, s starts after the tail and needs no search.
+    auto lo = spans.end();
+    if(std::prev(lo)->first > s.first)
+    {
+        lo = spans.upper_bound(s.first);
+    }
+    // erase may leave spans closer than the tolerance, reach them all.
+    while(lo != spans.begin() && std::prev(lo)->second + __tolerance >= s.first)
+    {
+        --lo;
+    }
+    auto hi = lo;
+    while(hi != spans.end() && hi->first <= s.second + __tolerance)
+    {
+        s.first = std::min(s.first, hi->first);
+        s.second = std::max(s.second, hi->second);
+        ++hi;
+    }
+    spans.emplace_hint(spans.erase(lo, hi), s);
+}
+
+void timeline_index::erase(uint64_t from, uint64_t to)
+{
+    if(from > to)
+    {
+        return;
+    }
+    for(auto& spans : __spans)
+    {
+        auto lo = first_after(spans, from);
+        auto hi = lo;
+        while(hi != spans.end() && hi->first <= to)
+        {
+            ++hi;
+        }
+        if(lo == hi)
+        {
+            continue;
+        }
+        // keep parts of the spans at both ends outside of the range.
+        std::vector<span> rest;
+        if(lo->first < from)
+        {
+            rest.push_back(span(lo->first, from - 1));
+        }
+        auto last = std::prev(hi);
+        if(last->second > to)
+        {
+            rest.push_back(span(to + 1, last->second));
+        }
+        auto pos = spans.erase(lo, hi);
+        for(auto& sp : rest)
+        {
+            spans.emplace_hint(pos, sp);
+        }
+    }
+}
+
+void timeline_index::clear()
+{
+    for(auto& spans : __spans)
+    {
+        spans.clear();
+    }
+}
+
+std::vector<timeline_index::span> timeline_index::query(
+    int index, uint64_t from, uint64_t to) const
+{
+    std::vector<span> found;
+    if(index < 0 || size_t(index) >= __spans.size())
+    {
+        return found;
+    }
+    auto& spans = __spans[index];
+    for(auto it = first_after(spans, from);
+        it != spans.end() && it->first <= to; ++it)
+    {
+        found.push_back(span(std::max(it->first, from),
+            std::min(it->second, to)));
+    }
+    return found;
+}
+
+size_t timeline_index::count(int index, uint64_t from, uint64_t to) const
+{
+    if(index < 0 || size_t(index) >= __spans.size())
+    {
+        return 0;
+    }
+    auto& spans = __spans[index];
+    size_t n = 0;
+    for(auto it = first_after(spans, from);
+        it != spans.end() && it->first <= to; ++it)
+    {
+        ++n;
+    }
+    return n;
+}
+
+uint64_t timeline_index::coverage(int index, uint64_t from, uint64_t to) const
+{
+    uint64_t total = 0;
+    for(auto& sp : query(index, from, to))
+    {
+        total += sp.second - sp.first;
+    }
+    return total;
+}
+
+bool timeline_index::empty(int index) const
+{
+    if(index < 0 || size_t(index) >= __spans.size())
+    {
+        return true;
+    }
+    return __spans[index].empty();
+}
+
+timeline_index::span timeline_index::back(int index) const
+{
+    if(empty(index))
+    {
+        return span(0, 0);
+    }
+    return *__spans[index].rbegin();
+}
+
+timeline_index::span_list::const_iterator timeline_index::first_after(
+    const span_list& spans, uint64_t time)
+{
+    // ends are in ascending order too,
+    // so only the span starting last before the time may reach it.
+    auto it = spans.upper_bound(time);
+    if(it != spans.begin() && std::prev(it)->second >= time)
+    {
+        --it;
+    }
+    return it;
+}
+
+} // end namespace vr
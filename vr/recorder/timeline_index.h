@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace vr
+{
+
+/*
+* Interval index over merged recording timelines.
+* Each timeline keeps disjoint spans in a map from start to end,
+* so both start and end of spans are in ascending order.
+* Spans closer than the tolerance are merged on insertion.
+* Appending or extending the tail is O(1), other insertions O(log n),
+* so rebuilding from storages in any order is not quadratic.
+* Queries take O(log n + k), k is the number of spans in range,
+* count and coverage included, as there are no per-span aggregates.
+*/
+class timeline_index
+{
+public:
+    typedef std::pair<uint64_t, uint64_t> span;
+
+    timeline_index(int num_timelines = 1, uint64_t tolerance = 1500);
+
+    void insert(int index, span s);
+
+    // cut [from, to] out of all timelines.
+    void erase(uint64_t from, uint64_t to);
+
+    void clear();
+
+    // spans intersecting [from, to], clipped to the range.
+    std::vector<span> query(int index, uint64_t from, uint64_t to) const;
+
+    // number of spans intersecting [from, to].
+    // it walks them, O(log n + k) like query.
+    size_t count(int index, uint64_t from, uint64_t to) const;
+
+    // total milliseconds recorded in [from, to], O(log n + k).
+    uint64_t coverage(int index, uint64_t from, uint64_t to) const;
+
+    bool empty(int index) const;
+
+    // the most recent span.
+    span back(int index) const;
+
+private:
+    // start to end of each span.
+    typedef std::map<uint64_t, uint64_t> span_list;
+
+    // first span whose end is not before the time.
+    static span_list::const_iterator first_after(
+        const span_list& spans, uint64_t time);
+
+    uint64_t __tolerance;
+    std::vector<span_list> __spans;
+};
+
+} // end namespace vr
@@ -0,0 +1,203 @@
+#include "vr/recorder/volume.h"
+#include "vr/utility/handy.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+extern "C"
+{
+#include <sys/statvfs.h>
+}
+
+namespace vr
+{
+
+void volume_set::histogram::add(uint64_t usec)
+{
+    size_t bucket = 0;
+    while(usec > 1 && bucket < buckets.size() - 1)
+    {
+        usec >>= 1;
+        ++bucket;
+    }
+    ++buckets[bucket];
+    ++total;
+}
+
+void volume_set::histogram::decay()
+{
+    total = 0;
+    for(auto& count : buckets)
+    {
+        count >>= 1;
+        total += count;
+    }
+}
+
+double volume_set::histogram::quantile(double q) const
+{
+    if(total == 0)
+    {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(total * q);
+    uint64_t seen = 0;
+    for(size_t n = 0; n < buckets.size(); ++n)
+    {
+        seen += buckets[n];
+        if(seen > target)
+        {
+            // upper bound of the bucket.
+            return double(uint64_t(1) << (n + 1)) / 1000.0;
+        }
+    }
+    return double(uint64_t(1) << buckets.size()) / 1000.0;
+}
+
+volume_set::volume_set(std::vector<std::string> roots)
+    : volume_set(roots, option())
+{}
+
+volume_set::volume_set(std::vector<std::string> roots, option opt)
+    : __opt(opt)
+{
+    auto now = std::chrono::steady_clock::now();
+    for(auto& root : roots)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(root, ec);
+        if(ec.value())
+        {
+            std::cerr<<"[VR] volume_set: fail to create "<<root<<std::endl;
+            continue;
+        }
+        volume vol;
+        vol.root = root;
+        vol.decayed = now;
+        refresh(vol, true);
+        __vols.push_back(vol);
+    }
+}
+
+std::vector<std::string> volume_set::roots() const
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    std::vector<std::string> roots;
+    for(auto& vol : __vols)
+    {
+        roots.push_back(vol.root);
+    }
+    return roots;
+}
+
+std::string volume_set::pick()
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    volume* best = nullptr;
+    double best_score = -1;
+    for(auto& vol : __vols)
+    {
+        refresh(vol, false);
+        if(!vol.healthy)
+        {
+            continue;
+        }
+        // free space discounted by typical write latency,
+        // and by storages placed on it since free space was checked.
+        uint64_t free_bytes = vol.free_bytes - std::min(vol.written, vol.free_bytes);
+        double score = double(free_bytes) / (1.0 + vol.hist.quantile(0.5)) /
+            (1.0 + vol.picked);
+        if(score > best_score)
+        {
+            best = &vol;
+            best_score = score;
+        }
+    }
+    if(!best)
+    {
+        // every volume is degraded, take the one with most free space.
+        for(auto& vol : __vols)
+        {
+            if(!best || vol.free_bytes > best->free_bytes)
+            {
+                best = &vol;
+            }
+        }
+    }
+    if(!best)
+    {
+        return std::string();
+    }
+    ++best->picked;
+    return best->root;
+}
+
+void volume_set::record_write(const std::string path,
+    std::chrono::microseconds latency, uint64_t bytes)
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    for(auto& vol : __vols)
+    {
+        // storages may be in sub folders, e.g. of pins.
+        if(!utility::is_under(path, vol.root))
+        {
+            continue;
+        }
+        vol.written += bytes;
+        auto now = std::chrono::steady_clock::now();
+        if(now - vol.decayed >= __opt.window)
+        {
+            vol.hist.decay();
+            vol.decayed = now;
+        }
+        vol.hist.add(latency.count());
+        if(vol.healthy && vol.hist.total >= __opt.min_samples &&
+            vol.hist.quantile(0.99) > __opt.slow_write.count())
+        {
+            std::cerr<<"[VR] volume_set: "<<vol.root<<" is degraded, p99 ";
+            std::cerr<<vol.hist.quantile(0.99)<<"ms"<<std::endl;
+            vol.healthy = false;
+            vol.degraded = now;
+        }
+        break;
+    }
+}
+
+std::vector<volume_set::stats> volume_set::get_stats()
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    std::vector<stats> all;
+    for(auto& vol : __vols)
+    {
+        refresh(vol, false);
+        all.push_back({vol.root, vol.free_bytes, vol.total_bytes,
+            vol.hist.quantile(0.5), vol.hist.quantile(0.99), vol.healthy});
+    }
+    return all;
+}
+
+void volume_set::refresh(volume& vol, bool force)
+{
+    auto now = std::chrono::steady_clock::now();
+    if(!vol.healthy && now - vol.degraded >= __opt.cooldown)
+    {
+        // try again with a fresh histogram.
+        vol.healthy = true;
+        vol.hist = histogram();
+    }
+    if(!force && now - vol.checked < std::chrono::seconds(5))
+    {
+        return;
+    }
+    struct statvfs st;
+    if(statvfs(vol.root.c_str(), &st) == 0)
+    {
+        vol.free_bytes = uint64_t(st.f_bavail) * st.f_frsize;
+        vol.total_bytes = uint64_t(st.f_blocks) * st.f_frsize;
+        vol.written = 0;
+        vol.picked = 0;
+    }
+    vol.checked = now;
+}
+
+} // end namespace vr
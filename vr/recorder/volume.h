@@ -0,0 +1,101 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vr
+{
+
+/*
+* Set of volumes(root folders on different disks) to place storages.
+* New storages go to the healthy volume with the best score of
+* free space and write latency.
+* Free space is checked every few seconds, so bytes written and storages
+* placed since then count against a volume, and storages of tapes rolling
+* over at the same time spread over volumes instead of piling on one.
+* A volume whose write latency degrades stops receiving new storages,
+* and gets a new chance after a cooldown.
+*/
+class volume_set
+{
+public:
+    struct option
+    {
+        // a volume degrades if p99 write latency exceeds this.
+        std::chrono::milliseconds slow_write{500};
+        // samples needed before judging a volume.
+        uint32_t min_samples = 100;
+        // degraded volume is tried again after cooldown.
+        std::chrono::seconds cooldown{300};
+        // histogram counts are halved every window.
+        std::chrono::seconds window{60};
+    };
+
+    struct stats
+    {
+        std::string root;
+        uint64_t free_bytes;
+        uint64_t total_bytes;
+        double p50_write_ms;
+        double p99_write_ms;
+        bool healthy;
+    };
+
+    volume_set(std::vector<std::string> roots);
+
+    volume_set(std::vector<std::string> roots, option opt);
+
+    std::vector<std::string> roots() const;
+
+    // root of the volume for a new storage, empty if there is no volume.
+    std::string pick();
+
+    // record latency and bytes of a write to the path(e.g. a storage),
+    // on the volume whose root has the path.
+    void record_write(const std::string path,
+        std::chrono::microseconds latency, uint64_t bytes = 0);
+
+    std::vector<stats> get_stats();
+
+private:
+    // write latency histogram in log2 buckets of microseconds.
+    struct histogram
+    {
+        std::array<uint32_t, 32> buckets{};
+        uint32_t total = 0;
+
+        void add(uint64_t usec);
+
+        void decay();
+
+        // latency at the quantile in milliseconds.
+        double quantile(double q) const;
+    };
+
+    struct volume
+    {
+        std::string root;
+        histogram hist;
+        uint64_t free_bytes = 0;
+        uint64_t total_bytes = 0;
+        // since free_bytes was checked.
+        uint64_t written = 0;
+        uint32_t picked = 0;
+        bool healthy = true;
+        std::chrono::steady_clock::time_point checked;
+        std::chrono::steady_clock::time_point decayed;
+        std::chrono::steady_clock::time_point degraded;
+    };
+
+    // update free space and health, caller must lock __mtx.
+    void refresh(volume& vol, bool force);
+
+    option __opt;
+    std::vector<volume> __vols;
+    mutable std::mutex __mtx;
+};
+
+} // end namespace vr
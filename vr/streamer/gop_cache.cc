@@ -0,0 +1,145 @@
+#include "vr/streamer/gop_cache.h"
+#include <iostream>
+
+extern "C"
+{
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+};
+
+namespace vr
+{
+
+shared_file::~shared_file()
+{
+    ::close(fd);
+}
+
+std::shared_ptr<const shared_file> shared_file::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        std::cerr<<"[VR] Fail to open: "<<path<<std::endl;
+        return nullptr;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        std::cerr<<"[VR] Fail to stat: "<<path<<std::endl;
+        ::close(fd);
+        return nullptr;
+    }
+    return std::shared_ptr<const shared_file>(
+        new shared_file{fd, uint64_t(st.st_dev), uint64_t(st.st_ino)});
+}
+
+gop_cache::gop_cache(size_t capacity)
+    : __capacity(std::max<size_t>(capacity, 1))
+{}
+
+std::shared_ptr<const gop_cache::gop> gop_cache::get(const storage::gop_location& loc)
+{
+    bool stale;
+    return get(loc, stale);
+}
+
+std::shared_ptr<const gop_cache::gop> gop_cache::get(
+    const storage::gop_location& loc, bool& stale)
+{
+    stale = false;
+    std::shared_ptr<const shared_file> file;
+    if(loc.ino != 0)
+    {
+        _FileId id(loc.dev, loc.ino);
+        std::unique_lock<std::mutex> lock(__mtx);
+        auto it = __gops.find(_Key(id, loc.loc));
+        if(it != __gops.end())
+        {
+            __lru.splice(__lru.begin(), __lru, it->second);
+            ++__hits;
+            return it->second->second;
+        }
+        // the file found in may be renamed over, but its gops are still there.
+        auto fit = __files.find(id);
+        if(fit != __files.end())
+        {
+            file = fit->second.lock();
+        }
+    }
+    // open and read without the lock, sessions on other footage go on.
+    if(!file)
+    {
+        file = shared_file::open(loc.file + ".data");
+        if(!file)
+        {
+            return nullptr;
+        }
+        if(loc.ino != 0 && (file->dev != loc.dev || file->ino != loc.ino))
+        {
+            // rewritten since the search, loc means nothing in this file.
+            stale = true;
+            return nullptr;
+        }
+    }
+    _Key key(_FileId(file->dev, file->ino), loc.loc);
+    {
+        std::unique_lock<std::mutex> lock(__mtx);
+        auto it = __gops.find(key);
+        if(it != __gops.end())
+        {
+            __lru.splice(__lru.begin(), __lru, it->second);
+            ++__hits;
+            return it->second->second;
+        }
+        ++__misses;
+    }
+    auto g = std::make_shared<gop>();
+    g->loc = loc;
+    g->frames = storage::frame_ranges(file->fd, loc);
+    g->file = file;
+    if(g->frames.empty())
+    {
+        return nullptr;
+    }
+
+    std::unique_lock<std::mutex> lock(__mtx);
+    auto it = __gops.find(key);
+    if(it != __gops.end())
+    {
+        // loaded by another session meanwhile.
+        return it->second->second;
+    }
+    __files[key.first] = g->file;
+    __lru.emplace_front(key, g);
+    __gops[key] = __lru.begin();
+    while(__lru.size() > __capacity)
+    {
+        auto id = __lru.back().first.first;
+        __gops.erase(__lru.back().first);
+        __lru.pop_back();
+        auto fit = __files.find(id);
+        if(fit != __files.end() && fit->second.expired())
+        {
+            __files.erase(fit);
+        }
+    }
+    return g;
+}
+
+size_t gop_cache::hits() const
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    return __hits;
+}
+
+size_t gop_cache::misses() const
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    return __misses;
+}
+
+} // end namespace vr
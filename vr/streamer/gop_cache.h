@@ -0,0 +1,79 @@
+#pragma once
+#include "vr/recorder/storage.h"
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vr
+{
+
+// a read only file, closed with its last reference.
+struct shared_file
+{
+    int fd;
+    // identity of the open file, to tell it from a file renamed over it.
+    uint64_t dev;
+    uint64_t ino;
+
+    ~shared_file();
+
+    // nullptr if it can not be opened.
+    static std::shared_ptr<const shared_file> open(const std::string& path);
+};
+
+/*
+* Recently played gops shared by playback sessions.
+* A gop is its frame ranges in the data file and the open file,
+* so sessions on the same footage read frame headers once
+* and send payloads straight from the page cache.
+* Gops and files are keyed by device and inode, not by name,
+* since a storage may be rewritten under its name(e.g. thinned).
+* Frame headers are read from the file payloads are sent from.
+*/
+class gop_cache
+{
+public:
+    struct gop
+    {
+        storage::gop_location loc;
+        std::vector<storage::frame_range> frames;
+        std::shared_ptr<const shared_file> file;
+    };
+
+    gop_cache(size_t capacity);
+
+    // the gop of the location, read on a miss.
+    // nullptr if it is not in its data file any more,
+    // stale too if the data file was rewritten since the gop was found,
+    // search again for the gop in the new file.
+    // blocks on disk reads, do not call it on an event loop.
+    std::shared_ptr<const gop> get(const storage::gop_location& loc);
+
+    std::shared_ptr<const gop> get(const storage::gop_location& loc, bool& stale);
+
+    size_t hits() const;
+
+    size_t misses() const;
+
+private:
+    // device and inode of a data file.
+    typedef std::pair<uint64_t, uint64_t> _FileId;
+    // a gop at its location in a data file.
+    typedef std::pair<_FileId, int64_t> _Key;
+
+    size_t __capacity;
+    // most recently used first.
+    std::list<std::pair<_Key, std::shared_ptr<const gop>>> __lru;
+    std::map<_Key, decltype(__lru)::iterator> __gops;
+    // files open for cached gops, shared by gops of a file.
+    std::map<_FileId, std::weak_ptr<const shared_file>> __files;
+    size_t __hits = 0;
+    size_t __misses = 0;
+    mutable std::mutex __mtx;
+};
+
+} // end namespace vr
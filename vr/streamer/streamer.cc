@@ -1,12 +1,24 @@
 #include "vr/streamer/streamer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <sstream>
 
 extern "C"
 {
 
 // UNIX NET/SOCKET
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
@@ -19,16 +31,17 @@ bool streamer::open(int port, int max_queue)
 {
     struct sockaddr_in address;
     int opt = 1;
-    if((_server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
+    if((_server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
     {
         perror("socket failed");
-        exit(EXIT_FAILURE);
+        return false;
     }
 
     if(setsockopt(_server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)))
     {
         perror("setsockopt");
-        exit(EXIT_FAILURE);
+        ::close(_server_fd);
+        return false;
     }
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
@@ -36,115 +49,1227 @@ bool streamer::open(int port, int max_queue)
     if(bind(_server_fd, (struct sockaddr *)&address, sizeof(address))<0)
     {
         perror("bind failed");
-        exit(EXIT_FAILURE);
+        ::close(_server_fd);
+        return false;
     }
+    if(listen(_server_fd, max_queue) < 0)
+    {
+        perror("listen");
+        ::close(_server_fd);
+        return false;
+    }
+
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // steady_clock is CLOCK_MONOTONIC.
+    _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(_epoll_fd < 0 || _event_fd < 0 || _timer_fd < 0)
+    {
+        perror("epoll");
+        for(auto fd : {&_server_fd, &_epoll_fd, &_event_fd, &_timer_fd})
+        {
+            if(*fd >= 0)
+            {
+                ::close(*fd);
+            }
+            *fd = -1;
+        }
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = _server_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _server_fd, &ev);
+    ev.data.fd = _event_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &ev);
+    ev.data.fd = _timer_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _timer_fd, &ev);
+    _armed = clock::time_point::max();
+
+    _io = std::make_unique<utility::thread_pool>(IO_THREADS);
+    _gops = std::make_shared<gop_cache>(GOP_CACHE_SIZE);
     _is_stop = false;
-    _acceptor = std::thread(
-        [this, &max_queue]()
+    _loop = std::thread([this](){ run(); });
+    return true;
+}
+
+bool streamer::close()
+{
+    if(_is_stop)
+    {
+        return false;
+    }
+    _is_stop = true;
+    wakeup();
+    if(_loop.joinable())
+    {
+        _loop.join();
+    }
+    // reads in flight post to the stopped loop, drop them after.
+    _io->close();
+    {
+        std::unique_lock<std::mutex> lock(_sbuf_mtx);
+        _posted.clear();
+        _sbuf.clear();
+    }
+    _timers = decltype(_timers)();
+    ::close(_timer_fd);
+    _channels.clear();
+    std::unique_lock<std::mutex> lock(_cli_mtx);
+    while(!_clients.empty())
+    {
+        drop(_clients.begin()->first);
+    }
+    _num_clients = 0;
+    ::close(_server_fd);
+    ::close(_event_fd);
+    ::close(_epoll_fd);
+    return true;
+}
+
+void streamer::broadcast(std::vector<uint8_t> data)
+{
+    broadcast(std::make_shared<const std::vector<uint8_t>>(std::move(data)));
+}
+
+void streamer::broadcast(std::shared_ptr<const std::vector<uint8_t>> data)
+{
+    broadcast(std::string(), std::move(data));
+}
+
+void streamer::broadcast(const std::string& channel,
+    std::shared_ptr<const std::vector<uint8_t>> data)
+{
+    broadcast(channel, std::move(data), 0, 0);
+}
+
+void streamer::broadcast(const std::string& channel,
+    std::shared_ptr<const std::vector<uint8_t>> data,
+    int64_t msec, uint8_t events)
+{
+    if(!data || data->empty())
+    {
+        return;
+    }
+    item it;
+    bool config = false;
+    it.size = data->size();
+    it.kind = classify(*data, config);
+    it.data = std::move(data);
+    it.msec = msec;
+    it.events = events;
+    it.flags = it.kind == frame_kind::key ? FLAG_KEY : 0;
+    it.flags |= config ? FLAG_CONFIG : 0;
+    {
+        std::unique_lock<std::mutex> lock(_sbuf_mtx);
+        _sbuf.emplace_back(channel, std::move(it));
+    }
+    wakeup();
+}
+
+bool streamer::broadcast_file(const std::string& path,
+    const std::vector<file_range>& ranges)
+{
+    auto file = shared_file::open(path);
+    if(!file)
+    {
+        return false;
+    }
+    {
+        std::unique_lock<std::mutex> lock(_sbuf_mtx);
+        for(auto& range : ranges)
         {
-            struct sockaddr_in address;
-            int addrlen = sizeof(address);
-            if (listen(_server_fd, max_queue) < 0)
+            if(range.offset < 0 || range.size <= 0)
             {
-                perror("listen");
-                exit(EXIT_FAILURE);
+                continue;
             }
-            while(true)
+            item it;
+            it.file = file;
+            it.offset = range.offset;
+            it.size = range.size;
+            // payloads are not read, so frames inside a gop are
+            // taken as reference frames.
+            it.kind = range.key ? frame_kind::key : frame_kind::reference;
+            it.flags = range.key ? FLAG_KEY : 0;
+            it.msec = range.msec;
+            it.events = range.events;
+            _sbuf.emplace_back(std::string(), std::move(it));
+        }
+    }
+    wakeup();
+    return true;
+}
+
+void streamer::set_tape_pool(std::shared_ptr<tape_pool> pool)
+{
+    std::unique_lock<std::mutex> lock(_cli_mtx);
+    _tape_pool = pool;
+}
+
+size_t streamer::clients() const
+{
+    return _num_clients;
+}
+
+void streamer::set_high_water(size_t bytes)
+{
+    _high_water = bytes;
+}
+
+void streamer::set_zerocopy(size_t bytes)
+{
+    _zc_threshold = bytes;
+}
+
+std::vector<streamer::client_stats> streamer::stats() const
+{
+    std::vector<client_stats> res;
+    auto now = clock::now();
+    std::unique_lock<std::mutex> lock(_cli_mtx);
+    for(auto& it : _clients)
+    {
+        auto& cli = it.second;
+        client_stats st;
+        st.addr = cli.addr;
+        st.queued_bytes = cli.pending_bytes - cli.offset;
+        st.queued_frames = cli.pending.size();
+        st.lag = std::chrono::milliseconds(0);
+        if(!cli.pending.empty())
+        {
+            st.lag = std::chrono::duration_cast<std::chrono::milliseconds>(
+                now - cli.pending.front().time);
+        }
+        st.sent_bytes = cli.sent_bytes;
+        st.sent_frames = cli.sent_frames;
+        st.dropped_bytes = cli.dropped_bytes;
+        st.dropped_frames = cli.dropped_frames;
+        st.dropped_gops = cli.dropped_gops;
+        st.waiting_idr = cli.waiting_idr;
+        st.channel = cli.channel;
+        st.position = 0;
+        if(cli.play)
+        {
+            st.tape = cli.play->tape_key;
+            st.position = cli.play->position;
+        }
+        st.zerocopy_sends = cli.zerocopy_sends;
+        st.zerocopy_copied = cli.zerocopy_copied;
+        res.push_back(st);
+    }
+    return res;
+}
+
+streamer::frame_kind streamer::classify(const std::vector<uint8_t>& data)
+{
+    bool config;
+    return classify(data, config);
+}
+
+streamer::frame_kind streamer::classify(const std::vector<uint8_t>& data, bool& config)
+{
+    bool annexb = false;
+    bool vcl = false;
+    bool ref = false;
+    bool idr = false;
+    config = false;
+    size_t i = 0;
+    size_t size = data.size();
+    while(i + 3 < size)
+    {
+        // start code 00 00 01, the 4 byte form ends the same way.
+        if(data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1)
+        {
+            ++i;
+            continue;
+        }
+        uint8_t header = data[i + 3];
+        int type = header & 0x1f;
+        annexb = true;
+        idr = idr || type == 5;
+        config = config || type == 7 || type == 8;
+        if(type >= 1 && type <= 4)
+        {
+            vcl = true;
+            ref = ref || (header & 0x60);
+        }
+        i += 4;
+    }
+    if(idr || !annexb)
+    {
+        return frame_kind::key;
+    }
+    if(!vcl)
+    {
+        // nothing depends on it, but a decoder can not start from it.
+        return frame_kind::non_vcl;
+    }
+    return ref ? frame_kind::reference : frame_kind::non_reference;
+}
+
+void streamer::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    while(!_is_stop)
+    {
+        int n = epoll_wait(_epoll_fd, events, MAX_EVENTS, -1);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        std::unique_lock<std::mutex> lock(_cli_mtx);
+        for(int i = 0; i < n; ++i)
+        {
+            int fd = events[i].data.fd;
+            auto flags = events[i].events;
+            if(fd == _server_fd)
+            {
+                accept_clients();
+            }
+            else if(fd == _timer_fd)
+            {
+                uint64_t count;
+                while(read(_timer_fd, &count, sizeof(count)) > 0);
+                // expired, arm_timer() sets it again.
+                _armed = clock::time_point::max();
+            }
+            else if(fd == _event_fd)
+            {
+                uint64_t count;
+                while(read(_event_fd, &count, sizeof(count)) > 0);
+                std::deque<std::function<void()>> posted;
+                {
+                    std::unique_lock<std::mutex> lock(_sbuf_mtx);
+                    posted.swap(_posted);
+                }
+                for(auto& job : posted)
+                {
+                    job();
+                }
+                dispatch();
+            }
+            else
+            {
+                auto it = _clients.find(fd);
+                if(it == _clients.end())
+                {
+                    continue;
+                }
+                if(flags & EPOLLHUP)
+                {
+                    drop(fd);
+                    continue;
+                }
+                // zerocopy completions come as errors too.
+                if((flags & EPOLLERR) && !reap_zerocopy(it->second))
+                {
+                    drop(fd);
+                    continue;
+                }
+                // commands sent right before a half close still run.
+                if((flags & (EPOLLIN | EPOLLRDHUP)) && !receive(it->second))
+                {
+                    drop(fd);
+                    continue;
+                }
+                // writable, or commands queued something(e.g. a joined gop).
+                if(((flags & EPOLLOUT) || !it->second.want_write) && !flush(it->second))
+                {
+                    drop(fd);
+                }
+            }
+        }
+        run_timers();
+        arm_timer();
+    }
+}
+
+void streamer::accept_clients()
+{
+    while(true)
+    {
+        struct sockaddr_in address;
+        socklen_t addrlen = sizeof(address);
+        int fd = accept4(_server_fd, (struct sockaddr *)&address, &addrlen,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("accept");
+            }
+            return;
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            ::close(fd);
+            continue;
+        }
+        char ip[INET_ADDRSTRLEN] = {};
+        inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+        client cli;
+        cli.fd = fd;
+        cli.addr = std::string(ip) + ":" + std::to_string(ntohs(address.sin_port));
+        if(_zc_threshold > 0)
+        {
+            int one = 1;
+            cli.zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+        }
+        auto& joined = _clients[fd];
+        joined = std::move(cli);
+        _num_clients = _clients.size();
+        join(joined, std::string());
+        if(!joined.want_write && !flush(joined))
+        {
+            drop(fd);
+        }
+    }
+}
+
+void streamer::dispatch()
+{
+    std::deque<std::pair<std::string, item>> sbuf;
+    {
+        std::unique_lock<std::mutex> lock(_sbuf_mtx);
+        sbuf.swap(_sbuf);
+    }
+    if(sbuf.empty())
+    {
+        return;
+    }
+    auto now = clock::now();
+    for(auto& frame : sbuf)
+    {
+        frame.second.time = now;
+        auto& gop = _channels[frame.first];
+        bool config = frame.second.kind == frame_kind::non_vcl &&
+            (frame.second.flags & FLAG_CONFIG);
+        if(config)
+        {
+            if(!gop.config_open)
+            {
+                gop.config.clear();
+            }
+            gop.config.push_back(frame.second);
+            gop.config_open = true;
+            continue;
+        }
+        gop.config_open = false;
+        if(frame.second.kind == frame_kind::key)
+        {
+            gop.frames.clear();
+            gop.bytes = 0;
+            gop.overflow = false;
+        }
+        if(gop.overflow)
+        {
+            continue;
+        }
+        gop.frames.push_back(frame.second);
+        gop.bytes += frame.second.size;
+        if(gop.bytes > MAX_JOIN_GOP_BYTES)
+        {
+            gop.frames.clear();
+            gop.bytes = 0;
+            gop.overflow = true;
+        }
+    }
+    std::vector<int> gone;
+    for(auto& it : _clients)
+    {
+        auto& cli = it.second;
+        if(cli.play)
+        {
+            continue;
+        }
+        for(auto& frame : sbuf)
+        {
+            if(frame.first == cli.channel)
+            {
+                enqueue(cli, frame.second);
+            }
+        }
+        // clients waiting for EPOLLOUT are flushed by the event.
+        if(!cli.want_write && !flush(cli))
+        {
+            gone.push_back(it.first);
+        }
+    }
+    for(auto fd : gone)
+    {
+        drop(fd);
+    }
+}
+
+void streamer::post(std::function<void()> job)
+{
+    {
+        std::unique_lock<std::mutex> lock(_sbuf_mtx);
+        _posted.push_back(std::move(job));
+    }
+    wakeup();
+}
+
+bool streamer::receive(client& cli)
+{
+    char buf[512];
+    ssize_t len;
+    while((len = recv(cli.fd, buf, sizeof(buf), 0)) > 0)
+    {
+        cli.input.append(buf, len);
+    }
+    bool eof = len == 0;
+    if(!eof && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+        return false;
+    }
+    size_t begin = 0;
+    size_t end;
+    while((end = cli.input.find('\n', begin)) != std::string::npos)
+    {
+        auto line = cli.input.substr(begin, end - begin);
+        if(!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        begin = end + 1;
+        command(cli, line);
+    }
+    cli.input.erase(0, begin);
+    if(eof)
+    {
+        // a client which asked for something still gets it after a half close,
+        // any other is gone once its output is out.
+        cli.eof = true;
+        update_events(cli);
+        return cli.commanded || !cli.pending.empty();
+    }
+    // not a command, e.g. a client writing media back.
+    return cli.input.size() <= MAX_COMMAND;
+}
+
+void streamer::command(client& cli, const std::string& line)
+{
+    std::istringstream iss(line);
+    std::string cmd;
+    iss >> cmd;
+    if(cmd.empty())
+    {
+        return;
+    }
+    cli.commanded = true;
+    if(cmd == "play")
+    {
+        std::string key;
+        int64_t sec;
+        double speed = 1;
+        if(!(iss >> key >> sec))
+        {
+            std::cerr<<"[VR] Usage: play <tape key> <time(sec)> [speed]"<<std::endl;
+            return;
+        }
+        iss >> speed;
+        auto tp = _tape_pool ? _tape_pool->find(key) : nullptr;
+        if(!tp || speed == 0)
+        {
+            std::cerr<<"[VR] Can not play "<<key<<" for "<<cli.addr<<std::endl;
+            return;
+        }
+        cli.play = std::make_unique<session>();
+        cli.play->tp = tp;
+        cli.play->tape_key = key;
+        cli.play->speed = speed;
+        cli.play->cursor = sec * 1000;
+        cli.play->position = sec * 1000;
+        restart(*cli.play);
+        // frames of the broadcast are not followed by the tape.
+        cli.waiting_idr = false;
+        load(cli);
+        return;
+    }
+    if(cmd == "framed" || cmd == "raw")
+    {
+        // frames queued already keep the mode they were queued with.
+        cli.framed = cmd == "framed";
+        return;
+    }
+    if(cmd == "live")
+    {
+        std::string channel;
+        iss >> channel;
+        join(cli, channel);
+        return;
+    }
+    if(!cli.play)
+    {
+        std::cerr<<"[VR] "<<cmd<<" without play from "<<cli.addr<<std::endl;
+        return;
+    }
+    auto& ss = *cli.play;
+    if(cmd == "seek")
+    {
+        int64_t sec;
+        if(!(iss >> sec))
+        {
+            return;
+        }
+        restart(ss);
+        ss.cursor = sec * 1000;
+        ss.position = sec * 1000;
+        ss.playlist.clear();
+        ss.gop = nullptr;
+        ss.next = nullptr;
+        if(!ss.paused)
+        {
+            load(cli);
+        }
+    }
+    else if(cmd == "speed")
+    {
+        double speed;
+        if(!(iss >> speed) || speed == 0)
+        {
+            return;
+        }
+        bool turned = (speed < 0) != (ss.speed < 0);
+        ss.speed = speed;
+        restart(ss);
+        if(turned)
+        {
+            // look up from where it is, the other way.
+            ss.cursor = ss.position + (speed < 0 ? -1 : 1);
+            ss.playlist.clear();
+            ss.gop = nullptr;
+            ss.next = nullptr;
+        }
+        if(!ss.paused)
+        {
+            ss.gop ? schedule(cli) : load(cli);
+        }
+    }
+    else if(cmd == "pause")
+    {
+        ss.paused = true;
+        restart(ss);
+    }
+    else if(cmd == "resume")
+    {
+        if(!ss.paused)
+        {
+            return;
+        }
+        ss.paused = false;
+        restart(ss);
+        ss.gop ? schedule(cli) : load(cli);
+    }
+    else
+    {
+        std::cerr<<"[VR] Unknown command from "<<cli.addr<<": "<<cmd<<std::endl;
+    }
+}
+
+void streamer::restart(session& ss)
+{
+    ss.generation = ++_generation;
+    ss.loading = false;
+    ss.anchor_time = clock::time_point();
+}
+
+void streamer::load(client& cli)
+{
+    auto& ss = *cli.play;
+    if(ss.loading)
+    {
+        return;
+    }
+    ss.loading = true;
+    int fd = cli.fd;
+    auto generation = ss.generation;
+    auto tp = ss.tp;
+    auto gops = _gops;
+    auto playlist = ss.playlist;
+    auto cursor = ss.cursor;
+    bool forward = ss.speed > 0;
+    _io->post(
+        [this, fd, generation, tp, gops, playlist, cursor, forward]() mutable
+        {
+            using namespace std::chrono;
+            int64_t now = duration_cast<milliseconds>(
+                system_clock::now().time_since_epoch()).count();
+            std::shared_ptr<const gop_cache::gop> gop;
+            // a day of windows, over longer gaps of recording it stops.
+            for(int windows = 0; !gop && windows < 24 * 6; )
             {
-                int new_cli = nonblocking_accept(_server_fd, 5,
-                    (struct sockaddr *)&address,
-                    (socklen_t*)&addrlen);
+                if(playlist.empty())
                 {
-                    std::unique_lock<std::mutex> lock(_cli_mtx);
-                    // _cli_cv.wait(lock, [this](){return _is_stop;});
-                    if(_is_stop)
+                    if(forward ? cursor > now : cursor <= 0)
                     {
                         break;
                     }
-                    if(new_cli > 0)
-                        _cli_list.push_back(new_cli);
+                    int64_t from = forward ? cursor : std::max<int64_t>(cursor - SEARCH_WINDOW_MS, 0);
+                    int64_t to = forward ? cursor + SEARCH_WINDOW_MS : cursor;
+                    auto found = tp->search(storage::event_query(), from, to);
+                    std::sort(found.begin(), found.end(),
+                        [forward](const storage::gop_location& a, const storage::gop_location& b)
+                        {
+                            return forward ? a.ts < b.ts : a.ts > b.ts;
+                        });
+                    for(auto& loc : found)
+                    {
+                        if(forward ? loc.ts_end >= cursor : loc.ts <= cursor)
+                        {
+                            playlist.push_back(loc);
+                        }
+                    }
+                    if(playlist.empty())
+                    {
+                        cursor = forward ? to + 1 : from - 1;
+                        ++windows;
+                        continue;
+                    }
+                }
+                auto loc = playlist.front();
+                playlist.pop_front();
+                cursor = forward ? loc.ts_end + 1 : loc.ts - 1;
+                bool stale = false;
+                gop = gops->get(loc, stale);
+                if(stale)
+                {
+                    // the storage was rewritten(e.g. thinned), search it again.
+                    playlist.clear();
+                    cursor = forward ? loc.ts : loc.ts_end;
+                    ++windows;
                 }
             }
+            post(
+                [this, fd, generation, gop, playlist, cursor]()
+                {
+                    loaded(fd, generation, gop, playlist, cursor);
+                });
         });
+}
 
-    _sender = std::thread(
-        [this]()
+void streamer::loaded(int fd, uint64_t generation,
+    std::shared_ptr<const gop_cache::gop> gop,
+    std::deque<storage::gop_location> playlist, int64_t cursor)
+{
+    auto it = _clients.find(fd);
+    if(it == _clients.end() || !it->second.play ||
+        it->second.play->generation != generation)
+    {
+        return;
+    }
+    auto& cli = it->second;
+    auto& ss = *cli.play;
+    ss.loading = false;
+    ss.playlist = std::move(playlist);
+    ss.cursor = cursor;
+    if(!gop)
+    {
+        if(ss.speed > 0 && !ss.gop)
+        {
+            // at the end of the tape, wait for more to be recorded.
+            _timers.add(clock::now() + std::chrono::seconds(1), {fd, generation});
+        }
+        return;
+    }
+    if(ss.gop)
+    {
+        ss.next = gop;
+        return;
+    }
+    ss.gop = gop;
+    ss.frame = 0;
+    schedule(cli);
+    // read ahead while it plays.
+    load(cli);
+}
+
+void streamer::schedule(client& cli)
+{
+    auto& ss = *cli.play;
+    auto now = clock::now();
+    auto msec = ss.gop->frames[ss.frame].msec.count();
+    auto speed = std::abs(ss.speed);
+    // media time to the frame in playing direction.
+    int64_t ahead = ss.speed > 0 ? msec - ss.anchor_msec : ss.anchor_msec - msec;
+    auto due = ss.anchor_time + std::chrono::microseconds(int64_t(ahead * 1000 / speed));
+    if(ss.anchor_time == clock::time_point() || ahead < 0 ||
+        due > now + std::chrono::milliseconds(MAX_FRAME_GAP_MS) ||
+        due + std::chrono::milliseconds(MAX_FRAME_GAP_MS) < now)
+    {
+        // started, jumped over a gap or fell behind.
+        ss.anchor_msec = msec;
+        ss.anchor_time = now;
+        due = now;
+    }
+    _timers.add(due, {cli.fd, ss.generation});
+}
+
+void streamer::step(client& cli)
+{
+    auto& ss = *cli.play;
+    if(!ss.gop)
+    {
+        // nothing was found at the end of the tape, look again.
+        load(cli);
+        return;
+    }
+    if(cli.pending_bytes > _high_water / 2)
+    {
+        // the client is behind, hold the tape instead of dropping frames.
+        auto delay = std::chrono::milliseconds(10);
+        ss.anchor_time += delay;
+        _timers.add(clock::now() + delay, {cli.fd, ss.generation});
+        return;
+    }
+    auto& gop = *ss.gop;
+    auto& fr = gop.frames[ss.frame];
+    if(ss.frame == 0 && gop.loc.extradata && !gop.loc.extradata->empty())
+    {
+        item extra;
+        extra.data = gop.loc.extradata;
+        extra.size = extra.data->size();
+        extra.kind = frame_kind::non_vcl;
+        extra.time = clock::now();
+        extra.msec = fr.msec.count();
+        extra.flags = FLAG_CONFIG;
+        enqueue(cli, extra);
+    }
+    item it;
+    it.file = gop.file;
+    it.offset = fr.offset;
+    it.size = fr.size;
+    it.kind = ss.frame == 0 ? frame_kind::key : frame_kind::reference;
+    it.time = clock::now();
+    it.msec = fr.msec.count();
+    it.events = fr.events;
+    it.flags = ss.frame == 0 ? FLAG_KEY : 0;
+    enqueue(cli, it);
+    ss.position = fr.msec.count();
+
+    // backward plays key frames only.
+    if(ss.speed > 0 && ++ss.frame < gop.frames.size())
+    {
+        schedule(cli);
+    }
+    else
+    {
+        ss.gop = ss.next;
+        ss.next = nullptr;
+        ss.frame = 0;
+        if(ss.gop)
+        {
+            schedule(cli);
+        }
+        load(cli);
+    }
+    if(!cli.want_write && !flush(cli))
+    {
+        drop(cli.fd);
+    }
+}
+
+void streamer::arm_timer()
+{
+    auto due = _timers.next_due();
+    if(due == _armed)
+    {
+        return;
+    }
+    struct itimerspec spec = {};
+    if(due != clock::time_point::max())
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            due.time_since_epoch()).count();
+        // zero disarms it, so a due time in the past is made 1ns.
+        ns = std::max<int64_t>(ns, 1);
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    _armed = due;
+}
+
+void streamer::run_timers()
+{
+    std::vector<timer> expired;
+    _timers.advance(clock::now(), expired);
+    for(auto& t : expired)
+    {
+        auto it = _clients.find(t.fd);
+        if(it == _clients.end() || !it->second.play ||
+            it->second.play->generation != t.generation ||
+            it->second.play->paused)
+        {
+            continue;
+        }
+        step(it->second);
+    }
+}
+
+void streamer::enqueue(client& cli, const item& it)
+{
+    size_t high_water = _high_water;
+    auto drop_frame = [&cli](const item& frame)
+    {
+        cli.dropped_bytes += frame.size;
+        ++cli.dropped_frames;
+    };
+    if(cli.waiting_idr)
+    {
+        // parameter sets and SEI still go, the IDR may need them.
+        if(it.kind != frame_kind::key && it.kind != frame_kind::non_vcl)
         {
-            while(true)
+            drop_frame(it);
+            return;
+        }
+        cli.waiting_idr = it.kind != frame_kind::key;
+    }
+    if(!cli.pending.empty() &&
+        cli.pending_bytes + it.size > high_water)
+    {
+        // the front may be partly sent, it has to go out whole.
+        auto begin = cli.pending.begin() + (cli.offset > 0 ? 1 : 0);
+        auto end = std::remove_if(begin, cli.pending.end(),
+            [&](const item& frame)
             {
-                std::unique_lock<std::mutex> lock(_sbuf_mtx);
-                _sender_cv.wait(lock,
-                    [this](){return _is_stop || !_sbuf.empty();});
-                if(_is_stop)
+                if(frame.kind != frame_kind::non_reference)
+                {
+                    return false;
+                }
+                drop_frame(frame);
+                cli.pending_bytes -= frame.size;
+                return true;
+            });
+        cli.pending.erase(end, cli.pending.end());
+    }
+    if(!cli.pending.empty() &&
+        cli.pending_bytes + it.size > high_water)
+    {
+        if(it.kind == frame_kind::non_reference)
+        {
+            drop_frame(it);
+            return;
+        }
+        // drop the queued gops, an IDR starts over right away.
+        auto begin = cli.pending.begin() + (cli.offset > 0 ? 1 : 0);
+        for(auto iter = begin; iter != cli.pending.end(); ++iter)
+        {
+            drop_frame(*iter);
+            cli.pending_bytes -= iter->size;
+        }
+        cli.pending.erase(begin, cli.pending.end());
+        ++cli.dropped_gops;
+        if(it.kind == frame_kind::non_vcl)
+        {
+            cli.waiting_idr = true;
+        }
+        else if(it.kind != frame_kind::key)
+        {
+            drop_frame(it);
+            cli.waiting_idr = true;
+            return;
+        }
+    }
+    cli.pending.push_back(it);
+    cli.pending.back().framed = cli.framed;
+    cli.pending_bytes += it.size;
+}
+
+void streamer::join(client& cli, const std::string& channel)
+{
+    cli.play.reset();
+    cli.channel = channel;
+    // frames not started belong to what it watched before.
+    auto begin = cli.pending.begin() + (cli.offset > 0 ? 1 : 0);
+    for(auto iter = begin; iter != cli.pending.end(); ++iter)
+    {
+        cli.pending_bytes -= iter->size;
+    }
+    cli.pending.erase(begin, cli.pending.end());
+    auto it = _channels.find(channel);
+    if(it == _channels.end())
+    {
+        cli.waiting_idr = true;
+        return;
+    }
+    // parameter sets go first, the gop or the next IDR needs them.
+    cli.waiting_idr = false;
+    for(auto& frame : it->second.config)
+    {
+        enqueue(cli, frame);
+    }
+    if(it->second.frames.empty() ||
+        it->second.frames.front().kind != frame_kind::key ||
+        it->second.bytes > _high_water)
+    {
+        // nothing to decode from that fits, start at the next IDR.
+        cli.waiting_idr = true;
+        return;
+    }
+    for(auto& frame : it->second.frames)
+    {
+        enqueue(cli, frame);
+    }
+}
+
+bool streamer::flush(client& cli)
+{
+    uint8_t headers[MAX_BATCH][FRAME_HEADER_SIZE];
+    struct iovec iov[MAX_BATCH * 2];
+    size_t zc_threshold = _zc_threshold;
+    auto zerocopy = [&cli, zc_threshold](const item& it)
+    {
+        return cli.zerocopy && zc_threshold > 0 && it.data && it.size >= zc_threshold;
+    };
+    while(!cli.pending.empty())
+    {
+        auto& front = cli.pending.front();
+        size_t hsize = front.framed ? FRAME_HEADER_SIZE : 0;
+        ssize_t sent;
+        if(front.data && !zerocopy(front))
+        {
+            // frames in memory go out together, up to a file range.
+            int niov = 0;
+            size_t skip = cli.offset;
+            size_t n = 0;
+            for(; n < cli.pending.size() && n < MAX_BATCH; ++n)
+            {
+                auto& it = cli.pending[n];
+                if(!it.data || zerocopy(it))
                 {
                     break;
                 }
-                auto data = _sbuf.front();
-                _sbuf.pop();
-                const int size = data.size();
-                for(auto cli : _cli_list)
+                if(it.framed)
                 {
-                    int total = 0;
-                    while(total != size)
+                    make_header(it, headers[n]);
+                    if(skip < FRAME_HEADER_SIZE)
                     {
-                        int sent = send(cli, data.data() + total,
-                            size - total, 0);
-                        if(sent <= 0)
-                        {
-                            break;
-                        }
-                        total += sent;
+                        iov[niov].iov_base = headers[n] + skip;
+                        iov[niov].iov_len = FRAME_HEADER_SIZE - skip;
+                        ++niov;
+                        skip = 0;
+                    }
+                    else
+                    {
+                        skip -= FRAME_HEADER_SIZE;
                     }
                 }
+                iov[niov].iov_base = const_cast<uint8_t*>(it.data->data()) + skip;
+                iov[niov].iov_len = it.size - skip;
+                ++niov;
+                skip = 0;
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = niov;
+            // more is coming right after, e.g. a file range.
+            int flags = MSG_NOSIGNAL | (n < cli.pending.size() ? MSG_MORE : 0);
+            sent = sendmsg(cli.fd, &msg, flags);
+        }
+        else if(cli.offset < hsize)
+        {
+            // a header is never sent by zerocopy, it is on the stack.
+            uint8_t header[FRAME_HEADER_SIZE];
+            make_header(front, header);
+            sent = send(cli.fd, header + cli.offset, hsize - cli.offset,
+                MSG_NOSIGNAL | MSG_MORE);
+        }
+        else if(front.data)
+        {
+            int flags = MSG_NOSIGNAL | (cli.pending.size() > 1 ? MSG_MORE : 0);
+            auto data = front.data->data() + cli.offset - hsize;
+            auto len = front.size + hsize - cli.offset;
+            sent = send(cli.fd, data, len, flags | MSG_ZEROCOPY);
+            if(sent < 0 && errno == ENOBUFS)
+            {
+                // over the limit of pinned pages, copy this one.
+                sent = send(cli.fd, data, len, flags);
+            }
+            else if(sent >= 0)
+            {
+                // the kernel reads the buffer until it notifies the id.
+                cli.zc_inflight.emplace_back(cli.zc_next++, front.data);
+                ++cli.zerocopy_sends;
+            }
+        }
+        else
+        {
+            off_t off = front.offset + cli.offset - hsize;
+            sent = sendfile(cli.fd, front.file->fd, &off,
+                front.size + hsize - cli.offset);
+            if(sent == 0 && cli.offset > 0)
+            {
+                // the file was cut(e.g. thinned) after a part of the frame
+                // or its header was sent, the stream can not be kept whole.
+                std::cerr<<"[VR] Frame cut short for "<<cli.addr<<std::endl;
+                return false;
+            }
+            if(sent == 0)
+            {
+                // the file is shorter than the range, skip it.
+                cli.pending_bytes -= front.size;
+                cli.offset = 0;
+                cli.pending.pop_front();
+                continue;
+            }
+        }
+        if(sent < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                want_write(cli, true);
+                return true;
+            }
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        cli.sent_bytes += sent;
+        // sent may cover several frames of a batch.
+        size_t left = sent;
+        while(left > 0)
+        {
+            auto& it = cli.pending.front();
+            size_t total = it.size + (it.framed ? FRAME_HEADER_SIZE : 0);
+            size_t step = std::min(left, total - cli.offset);
+            cli.offset += step;
+            left -= step;
+            if(cli.offset < total)
+            {
+                break;
+            }
+            cli.pending_bytes -= it.size;
+            ++cli.sent_frames;
+            cli.pending.pop_front();
+            cli.offset = 0;
+        }
+    }
+    want_write(cli, false);
+    // closed without asking for anything, its output is out.
+    return !cli.eof || cli.commanded;
+}
 
+void streamer::make_header(const item& it, uint8_t* header)
+{
+    header[0] = 'v';
+    header[1] = 'f';
+    header[2] = FRAME_VERSION;
+    header[3] = it.flags;
+    header[4] = it.events;
+    header[5] = header[6] = header[7] = 0;
+    uint32_t size = it.size;
+    for(int i = 0; i < 4; ++i)
+    {
+        header[8 + i] = uint8_t(size >> (8 * i));
+    }
+    uint64_t msec = it.msec;
+    for(int i = 0; i < 8; ++i)
+    {
+        header[12 + i] = uint8_t(msec >> (8 * i));
+    }
+}
+
+bool streamer::reap_zerocopy(client& cli)
+{
+    while(true)
+    {
+        char control[128];
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(cli.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            break;
+        }
+        for(auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            auto serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+            if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+            // ids from ee_info to ee_data are done.
+            uint32_t lo = serr->ee_info;
+            uint32_t hi = serr->ee_data;
+            auto end = std::remove_if(cli.zc_inflight.begin(), cli.zc_inflight.end(),
+                [lo, hi](const std::pair<uint32_t, buffer>& sent)
+                {
+                    return uint32_t(sent.first - lo) <= uint32_t(hi - lo);
+                });
+            cli.zc_inflight.erase(end, cli.zc_inflight.end());
+            if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                // e.g. loopback, pinning pages only costs more then.
+                cli.zerocopy_copied += uint32_t(hi - lo) + 1;
+                cli.zerocopy = false;
             }
         }
-    );
-    return true;
+    }
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(cli.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    return err == 0;
 }
 
-bool streamer::close()
+void streamer::want_write(client& cli, bool on)
 {
-    _is_stop = true;
-    _sender_cv.notify_one();
-    _sender.join();
-    _acceptor.join();
-    for(auto cli : _cli_list)
+    if(cli.want_write == on)
     {
-        ::close(cli);
+        return;
     }
-    ::close(_server_fd);
-    return true;
+    cli.want_write = on;
+    update_events(cli);
 }
 
-void streamer::broadcast(std::vector<uint8_t> data)
+void streamer::update_events(client& cli)
 {
-    std::unique_lock<std::mutex> lock(_sbuf_mtx);
-    _sbuf.push(data);
-    _sender_cv.notify_one();
+    struct epoll_event ev = {};
+    // EPOLLHUP and EPOLLERR are reported anyway.
+    ev.events = (cli.eof ? 0u : uint32_t(EPOLLIN | EPOLLRDHUP)) |
+        (cli.want_write ? uint32_t(EPOLLOUT) : 0u);
+    ev.data.fd = cli.fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, cli.fd, &ev);
 }
 
-int streamer::nonblocking_accept(
-    int sock,
-    int timeout,
-    struct sockaddr* addr,
-    socklen_t* len)
+void streamer::drop(int fd)
 {
-    int ret;
-    struct timeval tv;
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    FD_SET(sock, &rfds);
-    tv.tv_sec = (long)timeout;
-    tv.tv_usec = 0;
+    auto it = _clients.find(fd);
+    if(it != _clients.end() && !it->second.zc_inflight.empty())
+    {
+        // reset the connection so the kernel lets go of
+        // the buffers of zerocopy sends before they are freed.
+        struct linger lg = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    _clients.erase(fd);
+    _num_clients = _clients.size();
+}
 
-    ret = select(sock+1, &rfds, (fd_set *) 0, (fd_set *) 0, &tv);
-    if(ret > 0)
+void streamer::wakeup()
+{
+    uint64_t one = 1;
+    if(write(_event_fd, &one, sizeof(one)) < 0)
     {
-        return accept(sock, addr, len);
+        // counter is full, the loop is awake anyway.
     }
-    return -1;
 }
 
 } // end namespace vr
-
@@ -1,10 +1,18 @@
 #pragma once
+#include "vr/recorder/tape.h"
+#include "vr/streamer/gop_cache.h"
+#include "vr/utility/thread_pool.h"
+#include "vr/utility/timer_wheel.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <thread>
 #include <mutex>
-#include <condition_variable>
-#include <queue>
 
 extern "C"
 {
@@ -20,33 +28,381 @@ extern "C"
 namespace vr
 {
 
+/*
+* Streams broadcast data to tcp clients.
+* One event loop thread multiplexes the listening socket and all clients
+* with epoll on non-blocking sockets,
+* so a slow client never blocks the others.
+*
+* Broadcast data goes to channels(e.g. one per camera).
+* A client joins a channel with the current gop of it,
+* so it can decode from the first frame it gets.
+*
+* A client may send text commands, one per line,
+* to play a tape of the tape pool on its own instead of the broadcast.
+*   framed          send a header before each frame, see FRAME_HEADER_SIZE.
+*   raw             send frames back to back, the default.
+*   live [channel]  the broadcast of a channel, the default one if omitted.
+*   play <tape key> <time(sec)> [speed]
+*   seek <time(sec)>
+*   speed <rate>    negative plays backward by key frames.
+*   pause
+*   resume
+*/
 class streamer
 {
-    bool _is_stop;
-    int _server_fd;
-    std::vector<int> _cli_list;
-    std::queue<std::vector<uint8_t>> _sbuf;
-    std::mutex _cli_mtx;
+public:
+    using clock = std::chrono::steady_clock;
+
+    // h.264 frame class, decides what a lagging client drops first.
+    enum class frame_kind
+    {
+        key,        // IDR, or not h.264 annex-b at all.
+        reference,
+        non_reference,
+        non_vcl     // no picture, e.g. SPS/PPS, SEI or AUD.
+    };
+
+    struct client_stats
+    {
+        std::string addr;
+        size_t queued_bytes;
+        size_t queued_frames;
+        // age of the oldest queued frame.
+        std::chrono::milliseconds lag;
+        uint64_t sent_bytes;
+        uint64_t sent_frames;
+        uint64_t dropped_bytes;
+        uint64_t dropped_frames;
+        // gops dropped while waiting for the next IDR.
+        uint64_t dropped_gops;
+        bool waiting_idr;
+        // channel of the broadcast.
+        std::string channel;
+        // tape key of the playback session, empty for the broadcast.
+        std::string tape;
+        // time(ms) of the last frame played.
+        int64_t position;
+        // sends by MSG_ZEROCOPY, and of them copied by the kernel anyway.
+        uint64_t zerocopy_sends;
+        uint64_t zerocopy_copied;
+    };
+
+    // part of a file to send as one frame.
+    struct file_range
+    {
+        int64_t offset;
+        int64_t size;
+        // first frame of a gop.
+        bool key;
+        // time stamp(ms) and event bits for framed clients.
+        int64_t msec = 0;
+        uint8_t events = 0;
+    };
+
+private:
+    // one frame, shared by the queues of all clients.
+    using buffer = std::shared_ptr<const std::vector<uint8_t>>;
+
+    // a frame in memory, or a range of a file sent by sendfile.
+    struct item
+    {
+        buffer data;
+        std::shared_ptr<const shared_file> file;
+        int64_t offset = 0;
+        size_t size = 0;
+        frame_kind kind = frame_kind::key;
+        clock::time_point time;
+        // time stamp(ms) and event bits of the frame.
+        int64_t msec = 0;
+        uint8_t events = 0;
+        // FLAG_ bits of the frame header.
+        uint8_t flags = 0;
+        // sent with a frame header, by the mode of the client when queued.
+        bool framed = false;
+    };
+
+    // playback of a tape by one client.
+    struct session
+    {
+        std::shared_ptr<tape> tp;
+        std::string tape_key;
+        // playback rate, negative plays backward by key frames.
+        double speed = 1;
+        bool paused = false;
+        // renewed by every seek, speed and pause,
+        // timers and reads of an older generation are ignored.
+        uint64_t generation = 0;
+        // time(ms) the next gop is looked up from.
+        int64_t cursor = 0;
+        // gops found from the cursor, in play order.
+        std::deque<storage::gop_location> playlist;
+        std::shared_ptr<const gop_cache::gop> gop;
+        size_t frame = 0;
+        // gop read ahead of the playing one.
+        std::shared_ptr<const gop_cache::gop> next;
+        bool loading = false;
+        // frame times are put on the clock from this pair,
+        // anchor_time is zero until the next frame sets it.
+        int64_t anchor_msec = 0;
+        clock::time_point anchor_time;
+        // time(ms) of the last frame sent.
+        int64_t position = 0;
+    };
+
+    struct client
+    {
+        int fd;
+        std::string addr;
+        // data waiting for the socket to be writable.
+        std::deque<item> pending;
+        size_t pending_bytes = 0;
+        // bytes of the front of pending already sent.
+        size_t offset = 0;
+        // true if EPOLLOUT is registered.
+        bool want_write = false;
+        // lost a gop, nothing but an IDR is queued until the next one.
+        bool waiting_idr = false;
+        uint64_t sent_bytes = 0;
+        uint64_t sent_frames = 0;
+        uint64_t dropped_bytes = 0;
+        uint64_t dropped_frames = 0;
+        uint64_t dropped_gops = 0;
+        // channel of the broadcast it gets.
+        std::string channel;
+        // frames are sent with headers.
+        bool framed = false;
+        // received text up to an incomplete command.
+        std::string input;
+        // sent a command, it may half close afterwards(e.g. nc -N).
+        bool commanded = false;
+        // shut down its sending side, it is not read any more.
+        bool eof = false;
+        // nullptr while watching the broadcast.
+        std::unique_ptr<session> play;
+        // SO_ZEROCOPY is set, off again once the kernel copies.
+        bool zerocopy = false;
+        // id of the next MSG_ZEROCOPY send.
+        uint32_t zc_next = 0;
+        // buffers of zerocopy sends by id, kept until the kernel is done.
+        std::deque<std::pair<uint32_t, buffer>> zc_inflight;
+        uint64_t zerocopy_sends = 0;
+        uint64_t zerocopy_copied = 0;
+    };
+
+    // broadcast frames of a channel since its last key frame.
+    struct channel_gop
+    {
+        std::vector<item> frames;
+        size_t bytes = 0;
+        // the gop outgrew MAX_JOIN_GOP_BYTES, nothing is kept until the next key.
+        bool overflow = false;
+        // latest parameter sets broadcast on their own, sent before the gop.
+        // consecutive ones(e.g. SPS then PPS) make up one set.
+        std::vector<item> config;
+        bool config_open = false;
+    };
+
+    // next frame of a session.
+    struct timer
+    {
+        int fd;
+        uint64_t generation;
+    };
+
+    std::atomic<bool> _is_stop{true};
+    int _server_fd = -1;
+    int _epoll_fd = -1;
+    // wakes up the event loop for broadcast data and close.
+    int _event_fd = -1;
+    // wakes up the event loop for _timers.
+    int _timer_fd = -1;
+    // clients by socket, written by the event loop only.
+    std::map<int, client> _clients;
+    mutable std::mutex _cli_mtx;
+    std::atomic<size_t> _high_water{DEFAULT_HIGH_WATER};
+    // frames from this size are sent by MSG_ZEROCOPY, 0 is off.
+    std::atomic<size_t> _zc_threshold{0};
+    std::atomic<size_t> _num_clients{0};
+    // data broadcast but not handed to clients yet, with its channel.
+    std::deque<std::pair<std::string, item>> _sbuf;
+    // jobs to run on the event loop, e.g. results of reads.
+    std::deque<std::function<void()>> _posted;
     std::mutex _sbuf_mtx;
-    std::thread _acceptor;
-    std::thread _sender;
-    std::condition_variable _cli_cv;
-    std::condition_variable _sender_cv;
+    std::thread _loop;
+
+    // current gops by channel, used by the event loop only.
+    std::map<std::string, channel_gop> _channels;
+
+    // tapes to play, guarded by _cli_mtx.
+    std::shared_ptr<tape_pool> _tape_pool;
+    // reads of playback sessions.
+    std::unique_ptr<utility::thread_pool> _io;
+    std::shared_ptr<gop_cache> _gops;
+    // used by the event loop only.
+    utility::timer_wheel<timer> _timers;
+    // time _timer_fd is set to, time_point::max() if disarmed.
+    clock::time_point _armed = clock::time_point::max();
+    uint64_t _generation = 0;
 
 public:
+    // max events handled by one epoll_wait.
+    static constexpr int MAX_EVENTS = 256;
+    // queued bytes per client before frames are dropped.
+    static constexpr size_t DEFAULT_HIGH_WATER = 4 * 1024 * 1024;
+    // threads reading gops for playback sessions.
+    static constexpr size_t IO_THREADS = 4;
+    // gops kept by the gop cache.
+    static constexpr size_t GOP_CACHE_SIZE = 1024;
+    // span of one search for the gops of a session.
+    static constexpr int64_t SEARCH_WINDOW_MS = 10 * 60 * 1000;
+    // a longer wait between frames(e.g. over a gap of recording) is skipped.
+    static constexpr int64_t MAX_FRAME_GAP_MS = 1000;
+    // a larger gop of a channel is not kept for joining clients.
+    static constexpr size_t MAX_JOIN_GOP_BYTES = 16 * 1024 * 1024;
+    // max length of a command line.
+    static constexpr size_t MAX_COMMAND = 1024;
+    // frames sent by one sendmsg.
+    static constexpr int MAX_BATCH = 32;
+
+    /*
+    * In framed mode each frame follows a header, integers are little endian.
+    *   offset  size
+    *   0       2   magic 'v' 'f'
+    *   2       1   FRAME_VERSION
+    *   3       1   FLAG_ bits
+    *   4       1   event bits
+    *   5       3   reserved, zero
+    *   8       4   payload size
+    *   12      8   time stamp(ms), 0 if not known
+    */
+    static constexpr size_t FRAME_HEADER_SIZE = 20;
+    static constexpr uint8_t FRAME_VERSION = 1;
+    // IDR, a decoder can start from it.
+    static constexpr uint8_t FLAG_KEY = 0x01;
+    // codec extradata(SPS/PPS) of the following frames.
+    static constexpr uint8_t FLAG_CONFIG = 0x02;
+
     bool open(int port, int max_queue=5);
 
     bool close();
 
+    // broadcast to the default channel.
     void broadcast(std::vector<uint8_t> data);
 
+    // clients send straight from data, it must not change afterwards.
+    void broadcast(std::shared_ptr<const std::vector<uint8_t>> data);
+
+    void broadcast(const std::string& channel,
+        std::shared_ptr<const std::vector<uint8_t>> data);
+
+    // with the time stamp(ms) and event bits for framed clients.
+    void broadcast(const std::string& channel,
+        std::shared_ptr<const std::vector<uint8_t>> data,
+        int64_t msec, uint8_t events);
+
+    /*
+    * Send ranges of a file(e.g. frame payloads of a storage data file)
+    * from the page cache to clients, without reading them into memory.
+    * The file is opened once and shared by the queues of all clients.
+    */
+    bool broadcast_file(const std::string& path,
+        const std::vector<file_range>& ranges);
+
+    // tapes clients can play.
+    void set_tape_pool(std::shared_ptr<tape_pool> pool);
+
+    // number of connected clients.
+    size_t clients() const;
+
+    void set_high_water(size_t bytes);
+
+    /*
+    * Send frames in memory of at least the bytes by MSG_ZEROCOPY,
+    * 0(the default) turns it off. It pays off for large frames only,
+    * e.g. 256KB or more, and applies to clients connecting afterwards.
+    */
+    void set_zerocopy(size_t bytes);
+
+    std::vector<client_stats> stats() const;
+
+    /*
+    * Classify an annex-b h.264 access unit by its VCL NAL units,
+    * type 5 is IDR and nal_ref_idc 0 is not referenced by other frames.
+    * config is set if it has an SPS or a PPS.
+    */
+    static frame_kind classify(const std::vector<uint8_t>& data);
+
+    static frame_kind classify(const std::vector<uint8_t>& data, bool& config);
+
 private:
-    int nonblocking_accept(
-        int sock,
-        int timeout,
-        struct sockaddr* addr,
-        socklen_t* len);
+    void run();
+
+    void accept_clients();
+
+    // hand broadcast data to every client of its channel.
+    void dispatch();
+
+    // switch the client to a channel, starting with its current gop.
+    void join(client& cli, const std::string& channel);
+
+    // run a job on the event loop.
+    void post(std::function<void()> job);
+
+    // read commands from the client, false if it is gone.
+    bool receive(client& cli);
+
+    void command(client& cli, const std::string& line);
+
+    // read the next gop of the session on the I/O pool.
+    void load(client& cli);
+
+    // a read of load() is done.
+    void loaded(int fd, uint64_t generation,
+        std::shared_ptr<const gop_cache::gop> gop,
+        std::deque<storage::gop_location> playlist, int64_t cursor);
+
+    // schedule the next frame of the session.
+    void schedule(client& cli);
+
+    // send the due frame of the session.
+    void step(client& cli);
+
+    // start a new generation of the session, cancelling its timers and reads.
+    void restart(session& ss);
+
+    // set _timer_fd to the next due timer.
+    void arm_timer();
+
+    void run_timers();
+
+    /*
+    * Queue a frame for a client under the high-water mark.
+    * A lagging client loses its queued non-reference frames first,
+    * then the rest of its queue and everything up to the next IDR,
+    * so what it receives stays decodable.
+    */
+    void enqueue(client& cli, const item& it);
+
+    // send pending data until the socket would block,
+    // returns false if the client is gone.
+    bool flush(client& cli);
+
+    static void make_header(const item& it, uint8_t* header);
+
+    // release buffers of zerocopy sends the kernel is done with,
+    // false if the socket has an error.
+    bool reap_zerocopy(client& cli);
+
+    // register or unregister EPOLLOUT of the client.
+    void want_write(client& cli, bool on);
+
+    // set the epoll events of the client by want_write and eof.
+    void update_events(client& cli);
+
+    void drop(int fd);
+
+    void wakeup();
 };
 
 } // end namespace vr
-
@@ -0,0 +1,324 @@
+#include "vr/utility/catalog.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+#ifdef __linux__
+extern "C"
+{
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+}
+#endif
+
+namespace utility
+{
+
+bool parse_storage_name(const std::string& fname,
+    std::string& stem, std::string& ext)
+{
+    // YYYY-MM-DD@HH-MM-SS.ext
+    constexpr size_t stem_len = 19;
+    if(fname.size() < stem_len + 2 || fname[stem_len] != '.')
+    {
+        return false;
+    }
+    for(size_t n = 0; n < stem_len; ++n)
+    {
+        char c = fname[n];
+        switch(n)
+        {
+        case 4: case 7: case 13: case 16:
+            if(c != '-') return false;
+            break;
+        case 10:
+            if(c != '@') return false;
+            break;
+        default:
+            if(c < '0' || c > '9') return false;
+            break;
+        }
+    }
+    stem = fname.substr(0, stem_len);
+    ext = fname.substr(stem_len + 1);
+    return true;
+}
+
+catalog::catalog(std::vector<std::string> exts)
+    : __exts(exts)
+{}
+
+catalog::catalog(std::vector<std::string> exts, std::vector<std::string> skip_dirs)
+    : __exts(exts), __skip_dirs(skip_dirs)
+{}
+
+catalog::~catalog()
+{
+    close();
+}
+
+bool catalog::open(const std::string dir, bool watch)
+{
+    close();
+    if(!std::filesystem::is_directory(dir))
+    {
+        std::cerr<<"[VR] catalog::open - not a directory: "<<dir<<std::endl;
+        return false;
+    }
+    __root = dir;
+    if(watch)
+    {
+#ifdef __linux__
+        __fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(__fd < 0)
+        {
+            std::cerr<<"[VR] catalog::open - inotify_init1 failed"<<std::endl;
+        }
+#endif
+    }
+    // scan adds watches before listing,
+    // not to miss files created in between.
+    scan(dir);
+#ifdef __linux__
+    if(__fd >= 0)
+    {
+        __stop = false;
+        __watcher = std::thread([this](){ watch_loop(); });
+    }
+#endif
+    return true;
+}
+
+void catalog::close()
+{
+    __stop = true;
+    if(__watcher.joinable())
+    {
+        __watcher.join();
+    }
+#ifdef __linux__
+    if(__fd >= 0)
+    {
+        ::close(__fd);
+        __fd = -1;
+    }
+#endif
+    std::unique_lock<std::mutex> lock(__mtx);
+    __wds.clear();
+    __files.clear();
+}
+
+catalog::file_map catalog::list()
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    return __files;
+}
+
+void catalog::erase(const std::string fname)
+{
+    std::string stem, ext;
+    auto name = std::filesystem::path(fname).filename().string();
+    if(!parse_storage_name(name, stem, ext))
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(__mtx);
+    auto it = __files.find(stem);
+    if(it == __files.end())
+    {
+        return;
+    }
+    auto& names = it->second;
+    names.erase(std::remove(names.begin(), names.end(), name), names.end());
+    if(names.empty())
+    {
+        __files.erase(it);
+    }
+}
+
+void catalog::scan(const std::string dir)
+{
+    auto found = collect(dir);
+    std::unique_lock<std::mutex> lock(__mtx);
+    for(auto& it : found)
+    {
+        auto& names = __files[it.first];
+        for(auto& fname : it.second)
+        {
+            if(std::find(names.begin(), names.end(), fname) == names.end())
+            {
+                names.push_back(fname);
+            }
+        }
+    }
+}
+
+void catalog::rescan()
+{
+    // built aside, list() never sees a partial map.
+    auto found = collect(__root);
+    std::unique_lock<std::mutex> lock(__mtx);
+    __files.swap(found);
+}
+
+catalog::file_map catalog::collect(const std::string dir)
+{
+    file_map found;
+    std::string stem;
+    add_watch(dir);
+    std::error_code ec;
+    for(auto it = std::filesystem::recursive_directory_iterator(dir, ec);
+        it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+    {
+        if(ec.value())
+        {
+            break;
+        }
+        if(it->is_directory())
+        {
+            if(skipped(it->path().filename().string()))
+            {
+                it.disable_recursion_pending();
+                continue;
+            }
+            add_watch(it->path().string());
+        }
+        else
+        {
+            auto fname = it->path().filename().string();
+            if(tracked(fname, stem))
+            {
+                found[stem].push_back(fname);
+            }
+        }
+    }
+    return found;
+}
+
+bool catalog::tracked(const std::string fname, std::string& stem) const
+{
+    std::string ext;
+    return parse_storage_name(fname, stem, ext) &&
+        std::find(__exts.begin(), __exts.end(), ext) != __exts.end();
+}
+
+void catalog::insert(const std::string fname)
+{
+    std::string stem;
+    if(!tracked(fname, stem))
+    {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(__mtx);
+    auto& names = __files[stem];
+    if(std::find(names.begin(), names.end(), fname) == names.end())
+    {
+        names.push_back(fname);
+    }
+}
+
+bool catalog::skipped(const std::string dir_name) const
+{
+    return std::find(__skip_dirs.begin(), __skip_dirs.end(), dir_name) != __skip_dirs.end();
+}
+
+bool catalog::add_watch(const std::string dir)
+{
+#ifdef __linux__
+    if(__fd < 0)
+    {
+        return false;
+    }
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+    int wd = inotify_add_watch(__fd, dir.c_str(), mask);
+    if(wd < 0)
+    {
+        std::cerr<<"[VR] catalog::add_watch - fail to watch "<<dir<<std::endl;
+        return false;
+    }
+    std::unique_lock<std::mutex> lock(__mtx);
+    __wds[wd] = dir;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void catalog::watch_loop()
+{
+#ifdef __linux__
+    alignas(struct inotify_event) char buf[16 * 1024];
+    struct pollfd pfd = {__fd, POLLIN, 0};
+    while(!__stop)
+    {
+        int ret = poll(&pfd, 1, 500);
+        if(ret <= 0)
+        {
+            continue;
+        }
+        bool overflow = false;
+        while(true)
+        {
+            auto len = read(__fd, buf, sizeof(buf));
+            if(len <= 0)
+            {
+                break;
+            }
+            for(char* ptr = buf; ptr < buf + len;)
+            {
+                auto ev = reinterpret_cast<struct inotify_event *>(ptr);
+                ptr += sizeof(struct inotify_event) + ev->len;
+                if(ev->mask & IN_Q_OVERFLOW)
+                {
+                    overflow = true;
+                    continue;
+                }
+                if(ev->mask & IN_IGNORED)
+                {
+                    std::unique_lock<std::mutex> lock(__mtx);
+                    __wds.erase(ev->wd);
+                    continue;
+                }
+                if(ev->len == 0)
+                {
+                    continue;
+                }
+                std::string name = ev->name;
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                    if(ev->mask & IN_ISDIR)
+                    {
+                        if(skipped(name))
+                        {
+                            continue;
+                        }
+                        std::string dir;
+                        {
+                            std::unique_lock<std::mutex> lock(__mtx);
+                            dir = __wds[ev->wd];
+                        }
+                        scan((std::filesystem::path(dir) / name).string());
+                    }
+                    else
+                    {
+                        insert(name);
+                    }
+                }
+                else if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                {
+                    erase(name);
+                }
+            }
+        }
+        if(overflow)
+        {
+            // events were lost, the map may not match the disk.
+            std::cerr<<"[VR] catalog - inotify queue overflow, rescan "<<__root<<std::endl;
+            rescan();
+        }
+    }
+#endif
+}
+
+} // end namespace utility
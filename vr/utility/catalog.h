@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace utility
+{
+
+/*
+* Parses a storage file name like 2020-01-01@15-30-25.data
+* without std::regex.
+* stem is the name excluding extension.
+* ext is the extension excluding dot.
+*/
+bool parse_storage_name(const std::string& fname,
+    std::string& stem, std::string& ext);
+
+/*
+* In-memory view of storage files under a directory.
+* It scans the directory once on open, without std::regex.
+* If opened to watch, it follows created and deleted files with inotify
+* after that, on a thread of its own. If the inotify queue overflows,
+* events are lost and it rescans.
+* Otherwise the view is the files at open, less erased ones,
+* until rescan() is called.
+*/
+class catalog
+{
+public:
+    // key is the stem of file name, value is file names of the stem.
+    typedef std::map<std::string, std::vector<std::string>> file_map;
+
+    // exts are file extensions to track, excluding dot.
+    catalog(std::vector<std::string> exts);
+
+    // sub directories named one of skip_dirs are not tracked.
+    catalog(std::vector<std::string> exts, std::vector<std::string> skip_dirs);
+
+    ~catalog();
+
+    // watch is ignored on platforms without inotify.
+    bool open(const std::string dir, bool watch = false);
+
+    void close();
+
+    // same as get_matched_file_list(dir, regex) of the tracked files.
+    file_map list();
+
+    // forget a file which is removed by caller,
+    // not to wait until the delete event is delivered.
+    void erase(const std::string fname);
+
+    // replace the view by the files under the directory now.
+    void rescan();
+
+private:
+    // add files under the directory and watch it.
+    void scan(const std::string dir);
+
+    // files under the directory, watching it and its sub directories.
+    file_map collect(const std::string dir);
+
+    // true with the stem if the file name is tracked.
+    bool tracked(const std::string fname, std::string& stem) const;
+
+    void insert(const std::string fname);
+
+    bool skipped(const std::string dir_name) const;
+
+    bool add_watch(const std::string dir);
+
+    void watch_loop();
+
+private:
+    std::vector<std::string> __exts;
+    std::vector<std::string> __skip_dirs;
+    std::string __root;
+    file_map __files;
+    std::mutex __mtx;
+    // inotify file descriptor, -1 if not watching.
+    int __fd = -1;
+    // watch descriptor to directory path.
+    std::map<int, std::string> __wds;
+    std::thread __watcher;
+    std::atomic<bool> __stop{true};
+};
+
+} // namespace utility
@@ -0,0 +1,173 @@
+#include "vr/utility/deleter.h"
+#include "vr/utility/handy.h"
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+namespace utility
+{
+
+file_deleter::file_deleter()
+    : file_deleter(option())
+{}
+
+file_deleter::file_deleter(option opt)
+    : __opt(opt), __stop(false)
+{
+    __worker = std::thread(
+        [this]()
+        {
+            while(true)
+            {
+                std::pair<std::string, uint64_t> file;
+                {
+                    std::unique_lock<std::mutex> lock(__mtx);
+                    __cv.wait(lock,
+                        [this](){return __stop || !__files.empty();});
+                    if(__stop)
+                    {
+                        break;
+                    }
+                    file = __files.front();
+                }
+                erase(file.first, true);
+                {
+                    std::unique_lock<std::mutex> lock(__mtx);
+                    __files.pop_front();
+                    __pending_bytes -= std::min(__pending_bytes, file.second);
+                }
+            }
+        }
+    );
+}
+
+file_deleter::~file_deleter()
+{
+    close();
+}
+
+void file_deleter::remove(const std::vector<std::string> files)
+{
+    std::vector<std::pair<std::string, uint64_t>> sized;
+    for(auto& file : files)
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(file, ec);
+        sized.push_back(std::make_pair(file, ec.value() ? 0 : uint64_t(size)));
+    }
+    {
+        std::unique_lock<std::mutex> lock(__mtx);
+        for(auto& file : sized)
+        {
+            __files.push_back(file);
+            __pending_bytes += file.second;
+        }
+    }
+    __cv.notify_one();
+}
+
+void file_deleter::set_option(option opt)
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    __opt = opt;
+}
+
+file_deleter::option file_deleter::get_option()
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    return __opt;
+}
+
+size_t file_deleter::pending()
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    return __files.size();
+}
+
+uint64_t file_deleter::pending_bytes()
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    return __pending_bytes;
+}
+
+uint64_t file_deleter::pending_bytes(const std::string& dir)
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    uint64_t bytes = 0;
+    for(auto& file : __files)
+    {
+        if(is_under(file.first, dir))
+        {
+            bytes += file.second;
+        }
+    }
+    return bytes;
+}
+
+void file_deleter::close()
+{
+    {
+        std::unique_lock<std::mutex> lock(__mtx);
+        __stop = true;
+    }
+    __cv.notify_one();
+    if(__worker.joinable())
+    {
+        __worker.join();
+    }
+    std::deque<std::pair<std::string, uint64_t>> rest;
+    {
+        std::unique_lock<std::mutex> lock(__mtx);
+        rest.swap(__files);
+        __pending_bytes = 0;
+    }
+    for(auto& file : rest)
+    {
+        erase(file.first, false);
+    }
+}
+
+bool file_deleter::erase(const std::string& file, bool throttle)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    auto size = fs::file_size(file, ec);
+    if(ec.value())
+    {
+        // already removed.
+        return !fs::exists(file, ec);
+    }
+    auto opt = get_option();
+    // truncating would empty the other links too, e.g. pinned clips.
+    if(fs::hard_link_count(file, ec) > 1)
+    {
+        size = 0;
+    }
+    while(opt.step_bytes > 0 && size > opt.step_bytes)
+    {
+        size -= opt.step_bytes;
+        fs::resize_file(file, size, ec);
+        if(ec.value())
+        {
+            break;
+        }
+        if(throttle && opt.bytes_per_sec > 0)
+        {
+            auto usec = opt.step_bytes * 1000000 / opt.bytes_per_sec;
+            std::this_thread::sleep_for(std::chrono::microseconds(usec));
+        }
+        {
+            // stop throttling once closing.
+            std::unique_lock<std::mutex> lock(__mtx);
+            throttle = throttle && !__stop;
+        }
+    }
+    if(!fs::remove(file, ec))
+    {
+        std::cerr<<"[VR] file_deleter - fail to remove "<<file<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // end namespace utility
@@ -0,0 +1,70 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace utility
+{
+
+/*
+* Deletes files on a background thread.
+* Large files are truncated in steps before unlinking,
+* not to stall other writers on the same file system,
+* and the truncation keeps to an I/O budget.
+*/
+class file_deleter
+{
+public:
+    struct option
+    {
+        // bytes released per second, 0 is unlimited.
+        uint64_t bytes_per_sec = 256ull << 20;
+        // files are truncated by step_bytes at a time.
+        uint64_t step_bytes = 32ull << 20;
+    };
+
+    file_deleter();
+
+    file_deleter(option opt);
+
+    ~file_deleter();
+
+    // queue files to delete, returns immediately.
+    void remove(const std::vector<std::string> files);
+
+    void set_option(option opt);
+
+    option get_option();
+
+    // number of files waiting for deletion.
+    size_t pending();
+
+    // bytes of files waiting for deletion.
+    uint64_t pending_bytes();
+
+    // bytes of files under the folder waiting for deletion.
+    uint64_t pending_bytes(const std::string& dir);
+
+    // delete all queued files without the budget and stop.
+    void close();
+
+private:
+    // truncate and unlink a file, returns false on failure.
+    bool erase(const std::string& file, bool throttle);
+
+private:
+    option __opt;
+    // files waiting for deletion and their sizes.
+    std::deque<std::pair<std::string, uint64_t>> __files;
+    uint64_t __pending_bytes = 0;
+    std::mutex __mtx;
+    std::condition_variable __cv;
+    std::thread __worker;
+    bool __stop;
+};
+
+} // namespace utility
@@ -5,6 +5,13 @@
 #include <regex>
 #include <sstream>
 #include <iomanip>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#endif
 
 namespace utility
 {
@@ -53,6 +60,86 @@ bool create_directories(const std::string path, std::error_code& ec)
     return true;
 }
 
+bool is_under(const std::string path, const std::string dir)
+{
+    auto rel = std::filesystem::path(path).lexically_normal().lexically_relative(
+        std::filesystem::path(dir).lexically_normal());
+    return !rel.empty() && *rel.begin() != "..";
+}
+
+bool preallocate(const std::string path, int64_t bytes)
+{
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+    bool status = ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, bytes) == 0;
+    ::close(fd);
+    return status;
+#else
+    return false;
+#endif
+}
+
+bool clone_range(const std::string src, const std::string dst, int64_t from, int64_t to)
+{
+#ifdef __linux__
+    int src_fd = ::open(src.c_str(), O_RDONLY);
+    if(src_fd < 0)
+    {
+        return false;
+    }
+    int dst_fd = ::open(dst.c_str(), O_WRONLY | O_CREAT, 0644);
+    if(dst_fd < 0)
+    {
+        ::close(src_fd);
+        return false;
+    }
+    bool status = false;
+    struct stat st;
+    if(fstat(src_fd, &st) == 0 && st.st_blksize > 0)
+    {
+        int64_t blk = st.st_blksize;
+        struct file_clone_range range;
+        range.src_fd = src_fd;
+        range.src_offset = from - from % blk;
+        // zero length clones to the end of src.
+        int64_t end = (to + blk - 1) / blk * blk;
+        range.src_length = end >= st.st_size ? 0 : end - int64_t(range.src_offset);
+        range.dest_offset = range.src_offset;
+        status = ioctl(dst_fd, FICLONERANGE, &range) == 0;
+    }
+    ::close(dst_fd);
+    ::close(src_fd);
+    return status;
+#else
+    return false;
+#endif
+}
+
+bool punch_hole(const std::string path, int64_t from, int64_t to)
+{
+#ifdef __linux__
+    if(from >= to)
+    {
+        return true;
+    }
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if(fd < 0)
+    {
+        return false;
+    }
+    bool status = ::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+        from, to - from) == 0;
+    ::close(fd);
+    return status;
+#else
+    return false;
+#endif
+}
+
 std::vector<std::string>
 remove_files(const std::vector<std::string> files, const std::string root_dir)
 {
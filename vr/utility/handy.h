@@ -107,6 +107,22 @@ get_matched_file_list(const std::string dir, const std::string regex_str);
 
 bool create_directories(const std::string path, std::error_code& ec);
 
+// true if the path is in the folder or its sub folders, compared lexically.
+bool is_under(const std::string path, const std::string dir);
+
+// reserve disk blocks for the file without changing its size,
+// returns false if it is not supported.
+bool preallocate(const std::string path, int64_t bytes);
+
+// share disk blocks of src in [from, to) bytes with dst at the same offset,
+// the range is widened to the block size.
+// returns false if the file system does not support reflinks.
+bool clone_range(const std::string src, const std::string dst, int64_t from, int64_t to);
+
+// free disk blocks of the file in [from, to) bytes keeping its size,
+// returns false if it is not supported.
+bool punch_hole(const std::string path, int64_t from, int64_t to);
+
 // returns file name list failed to remove.
 std::vector<std::string>
 remove_files(const std::vector<std::string> files, const std::string root_dir = "");
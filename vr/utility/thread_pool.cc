@@ -0,0 +1,78 @@
+#include "vr/utility/thread_pool.h"
+#include <algorithm>
+
+namespace utility
+{
+
+thread_pool::thread_pool(size_t num_threads)
+    : __stop(false)
+{
+    for(size_t i = 0; i < std::max<size_t>(num_threads, 1); ++i)
+    {
+        __workers.emplace_back(
+            [this]()
+            {
+                while(true)
+                {
+                    std::function<void()> job;
+                    {
+                        std::unique_lock<std::mutex> lock(__mtx);
+                        __cv.wait(lock,
+                            [this](){return __stop || !__jobs.empty();});
+                        if(__jobs.empty())
+                        {
+                            break;
+                        }
+                        job = std::move(__jobs.front());
+                        __jobs.pop_front();
+                    }
+                    job();
+                }
+            }
+        );
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    close();
+}
+
+bool thread_pool::post(std::function<void()> job)
+{
+    {
+        std::unique_lock<std::mutex> lock(__mtx);
+        if(__stop)
+        {
+            return false;
+        }
+        __jobs.push_back(std::move(job));
+    }
+    __cv.notify_one();
+    return true;
+}
+
+size_t thread_pool::pending()
+{
+    std::unique_lock<std::mutex> lock(__mtx);
+    return __jobs.size();
+}
+
+void thread_pool::close()
+{
+    {
+        std::unique_lock<std::mutex> lock(__mtx);
+        __stop = true;
+    }
+    __cv.notify_all();
+    for(auto& worker : __workers)
+    {
+        if(worker.joinable())
+        {
+            worker.join();
+        }
+    }
+    __workers.clear();
+}
+
+} // namespace utility
@@ -0,0 +1,40 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utility
+{
+
+/*
+* Runs jobs on a fixed number of threads in posted order.
+* Blocking work(e.g. disk reads) is moved off event loops to it.
+*/
+class thread_pool
+{
+public:
+    thread_pool(size_t num_threads);
+
+    ~thread_pool();
+
+    // queue a job, returns false if the pool is closed.
+    bool post(std::function<void()> job);
+
+    // number of jobs waiting for a thread.
+    size_t pending();
+
+    // run queued jobs to the end and stop the threads.
+    void close();
+
+private:
+    std::deque<std::function<void()>> __jobs;
+    std::mutex __mtx;
+    std::condition_variable __cv;
+    std::vector<std::thread> __workers;
+    bool __stop;
+};
+
+} // namespace utility
@@ -0,0 +1,187 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace utility
+{
+
+/*
+* Hierarchical timer wheel.
+* Adding a timer and expiring it are O(1),
+* so thousands of timers can be run by one event loop.
+* Level 0 has a slot per tick, and a slot of each higher level spans
+* a whole turn of the level below. Timers move down a level
+* when their slot comes up, and expire from level 0 at their tick.
+*/
+template<typename T>
+class timer_wheel
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // slots of a level are 2^SLOT_BITS.
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int SLOTS = 1 << SLOT_BITS;
+    // 4 levels of 1ms ticks span 4.6 hours, later timers wait in overflow.
+    static constexpr int LEVELS = 4;
+
+    timer_wheel(clock::duration tick = std::chrono::milliseconds(1))
+        : __tick(tick), __start(clock::now())
+    {}
+
+    // add a timer, one due already expires by the next advance().
+    void add(clock::time_point due, T value)
+    {
+        ++__size;
+        auto t = to_tick(due);
+        if(t <= __now)
+        {
+            __due.emplace_back(t, std::move(value));
+            return;
+        }
+        place(t, std::move(value));
+    }
+
+    // move values of timers due by now to expired, in tick order.
+    void advance(clock::time_point now, std::vector<T>& expired)
+    {
+        uint64_t target = to_tick(now);
+        take(__due, expired);
+        while(__now < target)
+        {
+            if(__size == 0)
+            {
+                __now = target;
+                break;
+            }
+            ++__now;
+            cascade();
+            take(__slots[0][__now & (SLOTS - 1)], expired);
+        }
+    }
+
+    // time of the next tick having work, time_point::max() if none.
+    // a timer of a higher level is due at or after it.
+    clock::time_point next_due() const
+    {
+        if(__size == 0)
+        {
+            return clock::time_point::max();
+        }
+        if(!__due.empty())
+        {
+            return to_time(__now);
+        }
+        for(int level = 0; level < LEVELS; ++level)
+        {
+            int shift = SLOT_BITS * level;
+            uint64_t digit = (__now >> shift) & (SLOTS - 1);
+            for(uint64_t d = digit + 1; d < SLOTS; ++d)
+            {
+                if(!__slots[level][d].empty())
+                {
+                    uint64_t block = (__now >> (shift + SLOT_BITS)) << (shift + SLOT_BITS);
+                    return to_time(block | (d << shift));
+                }
+            }
+        }
+        // the overflow comes back at the next turn of the top level.
+        int top = SLOT_BITS * LEVELS;
+        return to_time(((__now >> top) + 1) << top);
+    }
+
+    size_t size() const
+    {
+        return __size;
+    }
+
+private:
+    typedef std::vector<std::pair<uint64_t, T>> _Slot;
+
+    uint64_t to_tick(clock::time_point tp) const
+    {
+        if(tp <= __start)
+        {
+            return 0;
+        }
+        // round up, a timer never expires early.
+        return (tp - __start + __tick - clock::duration(1)) / __tick;
+    }
+
+    clock::time_point to_time(uint64_t t) const
+    {
+        return __start + __tick * t;
+    }
+
+    // the lowest level where the tick and now differ only below it.
+    void place(uint64_t t, T value)
+    {
+        for(int level = 0; level < LEVELS; ++level)
+        {
+            int shift = SLOT_BITS * (level + 1);
+            if((t >> shift) == (__now >> shift))
+            {
+                auto slot = (t >> (SLOT_BITS * level)) & (SLOTS - 1);
+                __slots[level][slot].emplace_back(t, std::move(value));
+                return;
+            }
+        }
+        __overflow.emplace_back(t, std::move(value));
+    }
+
+    // bring down timers of higher levels whose slot starts at now.
+    void cascade()
+    {
+        int top = SLOT_BITS * LEVELS;
+        if((__now & ((uint64_t(1) << top) - 1)) == 0)
+        {
+            replace(__overflow);
+        }
+        for(int level = LEVELS - 1; level > 0; --level)
+        {
+            int shift = SLOT_BITS * level;
+            if((__now & ((uint64_t(1) << shift) - 1)) == 0)
+            {
+                replace(__slots[level][(__now >> shift) & (SLOTS - 1)]);
+            }
+        }
+    }
+
+    // timers due at now land in the level 0 slot expiring next.
+    void replace(_Slot& slot)
+    {
+        _Slot timers;
+        timers.swap(slot);
+        for(auto& timer : timers)
+        {
+            place(timer.first, std::move(timer.second));
+        }
+    }
+
+    void take(_Slot& slot, std::vector<T>& expired)
+    {
+        for(auto& timer : slot)
+        {
+            expired.push_back(std::move(timer.second));
+        }
+        __size -= slot.size();
+        slot.clear();
+    }
+
+private:
+    clock::duration __tick;
+    clock::time_point __start;
+    // ticks since __start processed by advance().
+    uint64_t __now = 0;
+    size_t __size = 0;
+    std::array<std::array<_Slot, SLOTS>, LEVELS> __slots;
+    // timers beyond the top level.
+    _Slot __overflow;
+    // timers already due, expired by the next advance().
+    _Slot __due;
+};
+
+} // namespace utility
@@ -1,4 +1,5 @@
 #pragma once
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -7,6 +8,7 @@ namespace vr
 
 struct frame
 {
+    // true on key frames, which need extradata() to be decoded alone.
     bool extra_data;
     std::vector<uint8_t> data;
 };
@@ -23,6 +25,10 @@ public:
     virtual bool disconnect() = 0;
 
     virtual frame read_frame() = 0;
+
+    // codec extradata(SPS/PPS) of the video stream.
+    // the same pointer is returned until it changes.
+    virtual std::shared_ptr<const std::vector<uint8_t>> extradata() = 0;
 };
 
 } // end namespace vr
@@ -1,4 +1,5 @@
 #include "vr/video/ffmpeg/rtsp_reader.h"
+#include <algorithm>
 
 namespace vr
 {
@@ -44,32 +45,11 @@ frame rtsp_reader::read_frame()
         auto stream_idx = this->_packet.stream_index;
         if(stream_idx == this->_video_idx)
         {
-            fr.data.clear();
-            std::vector<uint8_t> ext;
-            if (this->_packet.flags == AV_PKT_FLAG_KEY)
-            {
-                AVStream* in_stream  = this->_rtsp_ctx->streams[stream_idx];
-                auto ptr = in_stream->codecpar->extradata;
-                auto len = in_stream->codecpar->extradata_size;
-                ext = std::vector<uint8_t>(ptr, ptr + len);
-                fr.extra_data = true;
-            }
-            else
-            {
-                fr.extra_data = false;
-            }
+            // extradata is not prepended, see extradata().
+            fr.extra_data = this->_packet.flags & AV_PKT_FLAG_KEY;
             auto ptr = this->_packet.data;
             auto len = this->_packet.size;
-            std::vector<uint8_t> data(ptr, ptr + len);
-            fr.data.resize(len + ext.size());
-            std::copy(
-                ext.begin(),
-                ext.end(),
-                fr.data.begin());
-            std::copy(
-                data.begin(),
-                data.end(),
-                fr.data.begin() + ext.size());
+            fr.data = std::vector<uint8_t>(ptr, ptr + len);
             av_packet_unref(&this->_packet);
             break;
         }
@@ -77,6 +57,20 @@ frame rtsp_reader::read_frame()
     return fr;
 }
 
+std::shared_ptr<const std::vector<uint8_t>> rtsp_reader::extradata()
+{
+    AVStream* in_stream  = this->_rtsp_ctx->streams[this->_video_idx];
+    auto ptr = in_stream->codecpar->extradata;
+    auto len = in_stream->codecpar->extradata_size;
+    if(!this->_extradata ||
+        this->_extradata->size() != len ||
+        !std::equal(ptr, ptr + len, this->_extradata->begin()))
+    {
+        this->_extradata = std::make_shared<std::vector<uint8_t>>(ptr, ptr + len);
+    }
+    return this->_extradata;
+}
+
 AVFormatContext* rtsp_reader::create_rtsp_context(std::string url){
     AVFormatContext *rtsp_ctx = avformat_alloc_context();
     AVDictionary *dicts = NULL;
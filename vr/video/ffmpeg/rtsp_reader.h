@@ -30,6 +30,8 @@ public:
 
     frame read_frame() override;
 
+    std::shared_ptr<const std::vector<uint8_t>> extradata() override;
+
 /*
  * private member functions
  */
@@ -45,6 +47,7 @@ private:
     AVFormatContext* _rtsp_ctx;
     AVPacket _packet;
     int _video_idx;
+    std::shared_ptr<const std::vector<uint8_t>> _extradata;
 };
 
 } // end namespace vr